@@ -28,6 +28,9 @@ selectable = {
 multi_text = {"ine_comment", "multiline_comment", "doc_comment",}
 floating = {"doc_comment", "multiline_comment", "line_comment"}
 
+-- node type of function definition (scope "Current function" of find and replace)
+function_node = "funct_definition"
+
 -- does language support multiline comments?
 multiline_support = "true"
 
@@ -12,6 +12,7 @@ selectable = {"general_text", "line", "word", "unknown"}	-- list of nonterminal
 multi_text = {}	-- list of nonterminal elements able/allowed to contain more lines of text (in their child terminals)
 floating = {}			-- list of floating elements
 multiline_support = "false"		-- natural support for multiline comments in language
+function_node = ""		-- node type of function definition, empty if language has none
 line_tokens = {}	-- start & end tokens for line comment
 multiline_tokens = {}		-- start & end tokens for multiline comment; if language does not support multiline comments, define custom tokens
 
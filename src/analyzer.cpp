@@ -21,6 +21,7 @@ const char *Analyzer::SELECTABLE_TOKENS_FIELD = "selectable";
 const char *Analyzer::MULTI_TEXT_TOKENS_FIELD = "multi_text";
 const char *Analyzer::FLOATING_TOKENS_FIELD = "floating";
 const char *Analyzer::MULTILINE_SUPPORT_FIELD = "multiline_support";
+const char *Analyzer::FUNCTION_TOKEN_FIELD = "function_node";
 const char *Analyzer::LINE_COMMENT_TOKENS_FIELD = "line_tokens";
 const char *Analyzer::MULTILINE_COMMENT_TOKENS_FIELD = "multiline_tokens";
 const char *Analyzer::CONFIG_KEYS_FIELD = "cfg_keys";
@@ -135,7 +136,12 @@ void Analyzer::setupConstants()
 
     while (lua_next(L, -2) != 0)
     {
-        pairedTokens.append(QString(lua_tostring(L, -1)));
+        QString token = QString(lua_tostring(L, -1));
+
+        if (!pairIndexes.contains(token))
+            pairIndexes[token] = pairedTokens.size();
+
+        pairedTokens.append(token);
         lua_pop(L, 1);
     }
 
@@ -173,6 +179,11 @@ void Analyzer::setupConstants()
     multilineSupport = QString(lua_tostring(L, -1));
     lua_pop(L, 1);
 
+    // get node type of function definition (optional)
+    lua_getglobal (L, FUNCTION_TOKEN_FIELD);
+    functionToken = QString(lua_tostring(L, -1));
+    lua_pop(L, 1);
+
     QStringList tokens;
 
     // get line tokens
@@ -441,25 +452,30 @@ TreeElement* Analyzer::analyzeFull(QString input)
 /**
  * Reanalyze text from element and it's descendants, updates AST and returns first modified node
  * @param element input TreeElement to be reanlyzed
+ * @param text new text of element, current text of element if null
  * @return first modified node
  */
-TreeElement *Analyzer::analyzeElement(TreeElement* element)
+TreeElement *Analyzer::analyzeElement(TreeElement* element, QString text)
 {
     QString grammar = "";
     TreeElement *subRoot = 0;
 
     if (element != 0)
+    {
         grammar = subGrammars[element->getType()];
 
+        if (text.isNull()) text = element->getText();
+    }
+
     if (!grammar.isEmpty())
     {
         try
         {
             if(TreeElement::DYNAMIC){
             //!dopln
-                subRoot = reanalyzeString(element, grammar, element->getText());
+                subRoot = reanalyzeString(element, grammar, text);
             }else{
-            subRoot = analyzeString(grammar, element->getText());
+            subRoot = analyzeString(grammar, text);
             }
         }
         catch(QString exMsg)
@@ -471,6 +487,25 @@ TreeElement *Analyzer::analyzeElement(TreeElement* element)
     return subRoot;
 }
 
+/**
+ * Checks whether leaf is (part of) a comment, that is it lies in a node of floating
+ * (comment) type or its text starts with a comment token of the language.
+ * @param leaf input TreeElement
+ * @return true if leaf belongs to a comment
+ */
+bool Analyzer::isComment(TreeElement *leaf) const
+{
+    for (TreeElement *el = leaf; el != 0; el = el->getParent())
+        if (el->isFloating() || floatingTokens.contains(el->getType())) return true;
+
+    QString text = leaf->getType().trimmed();
+    QString lineStart = commentTokens.value("line").value(0);
+    QString multilineStart = commentTokens.value("multiline").value(0);
+
+    return (!lineStart.isEmpty() && text.startsWith(lineStart))
+            || (!multilineStart.isEmpty() && text.startsWith(multilineStart));
+}
+
 /**
  * Returns the analysable ancestor of the element
  * @param element input TreeElement
@@ -492,37 +527,81 @@ TreeElement *Analyzer::getAnalysableAncestor(TreeElement *element)
         return element;
 }
 
+// one nested lua table being converted in createTreeFromLuaStack()
+struct LuaTableFrame
+{
+    int ref;            //! registry reference of the table
+    int length;         //! count of items in table
+    int index;          //! next item to be converted
+    TreeElement *root;
+    QHash<QString, QList<TreeElement*> > openElements; //! unpaired opening children
+};
+
 /**
  * Creates AST from recursive lua tables (from stack), returns root(s)
+ * Nested tables are walked with explicit stack of frames. Open tables are held
+ * by registry references, so lua stack does not grow with depth of the tree.
  * @return root of AST
  */
 TreeElement *Analyzer::createTreeFromLuaStack()
 {
-    TreeElement *root = 0;
-    lua_pushnil(L);               //! first key
-
-    while (lua_next(L, -2) != 0) //! uses 'key' (at index -2) and 'value' (at index -1)
+    QList<LuaTableFrame> frames;
+    LuaTableFrame first;
+    first.root = 0;
+    first.index = 1;
+    first.length = lua_objlen(L, -1);
+    lua_pushvalue(L, -1);       //! root table stays on stack for caller
+    first.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    frames.append(first);
+
+    while (true)
     {
-        if(lua_istable(L, -1))
+        LuaTableFrame &frame = frames.last();
+
+        if (frame.index > frame.length) //! table finished
         {
-            TreeElement *child = createTreeFromLuaStack();
+            TreeElement *child = frame.root;
+            luaL_unref(L, LUA_REGISTRYINDEX, frame.ref);
+            frames.removeLast();
 
-            if (root == 0)  //! should not happen when tables are properly nested
+            if (frames.isEmpty())
+                return child;
+
+            LuaTableFrame &parentFrame = frames.last();
+
+            if (parentFrame.root == 0)  //! should not happen when tables are properly nested
             {
-                root = child;
+                parentFrame.root = child;
             }
-            else
+            else if (child != 0)
             {
-                root->appendChild(child);
-                checkPairing(child);
+                parentFrame.root->appendChild(child);
+                checkPairing(child, parentFrame.openElements);
             }
+            continue;
+        }
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, frame.ref);
+        lua_rawgeti(L, -1, frame.index++);
+        lua_remove(L, -2);      //! only the item is kept on stack
+
+        if(lua_istable(L, -1))
+        {
+            LuaTableFrame nested;
+            nested.root = 0;
+            nested.index = 1;
+            nested.length = lua_objlen(L, -1);
+            nested.ref = luaL_ref(L, LUA_REGISTRYINDEX);    //! pops the table
+            frames.append(nested);
+            continue;
         }
         else
         {
+            TreeElement *&root = frame.root;
             QString nodeName = QString(lua_tostring(L, -1));
             bool paired = false;
 
-            if (pairedTokens.indexOf(nodeName, 0) >= 0) //! pairing needed
+            if (pairIndexes.contains(nodeName)) //! pairing needed
             {
                 paired = true;
             }
@@ -534,9 +613,8 @@ TreeElement *Analyzer::createTreeFromLuaStack()
             if (floatingTokens.contains(nodeName))
                 root->setFloating(true);
         }
-        lua_pop(L, 1); //! removes 'value'; keeps 'key' for next iteration
+        lua_pop(L, 1); //! removes item
     }
-    return root;
 }
 
 /**
@@ -674,7 +752,7 @@ TreeElement *Analyzer::getElementAST()
 
     QString nodeName = QString(lua_tostring(L, -1));
     bool paired = false;
-    if (pairedTokens.indexOf(nodeName, 0) >= 0) //! pairing needed
+    if (pairIndexes.contains(nodeName)) //! pairing needed
     {
         paired = true;
     }
@@ -882,40 +960,33 @@ TreeElement* Analyzer::getParentElementAST(){
 }
 
 /**
- * Check the pairing of the element
- * @param closeEl input TreeElement
+ * Check the pairing of the element, called for each child appended to a parent.
+ * Opening elements wait on a stack per token, closing element takes the closest
+ * unused opening sibling from the stack, so pairing of all children is O(n).
+ * @param el appended TreeElement
+ * @param openElements unpaired opening siblings of el, by token
  */
-void Analyzer::checkPairing(TreeElement *closeEl)
+void Analyzer::checkPairing(TreeElement *el, QHash<QString, QList<TreeElement*> > &openElements)
 {
-    QString nodeName = closeEl->getType();
-    int pairIndex = pairedTokens.indexOf(nodeName, 0);
+    QHash<QString, int>::const_iterator it = pairIndexes.constFind(el->getType());
 
-    if (pairIndex >= 0) //! pairing needed
-    {
-        if (pairIndex % 2 == 1)  //! closing element found
-        {
-            QList<TreeElement *> siblings = closeEl->getParent()->getChildren();
-            siblings.removeOne(closeEl);
-            int index = siblings.size()-1;
+    if (it == pairIndexes.constEnd()) return; //! no pairing needed
 
-            QString openString = pairedTokens[pairIndex-1];
+    int pairIndex = it.value();
 
-            while (index >= 0)
-            {
-                // find closest matching unused opening element
-                TreeElement *openEl = siblings[index];
+    if (pairIndex % 2 == 0) //! opening element found
+    {
+        openElements[el->getType()].append(el);
+    }
+    else                    //! closing element found
+    {
+        QHash<QString, QList<TreeElement*> >::iterator open = openElements.find(pairedTokens[pairIndex-1]);
 
-                if (openEl->getType() == openString) //! is matching?
-                {
-                    if (openEl->getPair() == 0) //! is unused?
-                    {
-                        openEl->setPair(closeEl);
-                        closeEl->setPair(openEl);
-                        break;
-                    }
-                }
-                index--;
-            }
+        if (open != openElements.end() && !open.value().isEmpty())
+        {
+            TreeElement *openEl = open.value().takeLast();
+            openEl->setPair(el);
+            el->setPair(openEl);
         }
     }
 }
@@ -29,12 +29,14 @@ public:
     Analyzer(QString script);
     ~Analyzer();
     TreeElement *analyzeFull(QString input);
-    TreeElement *analyzeElement(TreeElement *element);
+    TreeElement *analyzeElement(TreeElement *element, QString text = QString());
     TreeElement *getAnalysableAncestor(TreeElement *element);
+    bool isComment(TreeElement *leaf) const;
     QStringList getExtensions() const {return extensions;}
     QString getLanguageName() const {return langName;}
     QString getSnippet() const {return defaultSnippet;}
     QString queryMultilineSupport() const {return multilineSupport;}
+    QString getFunctionToken() const {return functionToken;}
     QHash<QString, QStringList> getCommentTokens() const {return commentTokens;}
     QList<QPair<QString, QHash<QString, QString> > > readConfig(QString fileName);
     void readSnippet(QString fileName);
@@ -71,6 +73,7 @@ private:
     static const char *MULTI_TEXT_TOKENS_FIELD;
     static const char *FLOATING_TOKENS_FIELD;
     static const char *MULTILINE_SUPPORT_FIELD;
+    static const char *FUNCTION_TOKEN_FIELD;
     static const char *LINE_COMMENT_TOKENS_FIELD;
     static const char *MULTILINE_COMMENT_TOKENS_FIELD;
     static const char *CONFIG_KEYS_FIELD;
@@ -82,17 +85,19 @@ private:
     QString mainGrammar;        //! name of complete gramar
     QHash<QString, QString> subGrammars;//! names of partial grammars
     QStringList pairedTokens;           //! list of paired tokens, example: "{", "}", "begin", "end"...
+    QHash<QString, int> pairIndexes;    //! index of each paired token in pairedTokens
     QStringList selectableTokens;       //! list of tokens which can contain line-breaking children
     QStringList multiTextTokens;        //! list of tokens which can contain more lines of text
     QStringList floatingTokens;         //! list of tokens allowed to say out of hierarchy
     QString defaultSnippet;             //! code that will be displayed in new file
     QString multilineSupport;           //! natural support of multiline comments
+    QString functionToken;              //! node type of function definition, empty if none
     QHash<QString, QStringList> commentTokens;      //! start & end tokens for comments
 
     void setupConstants();
     TreeElement* analyzeString(QString grammar, QString input);
     TreeElement* createTreeFromLuaStack();
-    void checkPairing(TreeElement *element);
+    void checkPairing(TreeElement *element, QHash<QString, QList<TreeElement*> > &openElements);
 
     void processWhites(TreeElement *root); //! move all whites as high as possible without changing tree text
 
@@ -109,8 +109,8 @@ int S = 40;
  */
 QPointF Arrow::startPoint()
 {
-    QPointF startLT = mapFromItem(myStartItem, 0, 0);
-    QPointF endLT = mapFromItem(myEndItem, 0, 0);
+    QPointF startLT = mapFromParent(myStartItem->posInGroup());
+    QPointF endLT = mapFromParent(myEndItem->posInGroup());   //! target may be out of scene
     if(startLT.x() + myStartItem->idealSize().width() + S
         < endLT.x() + myEndItem->idealSize().width())
         return startLT + QPointF(myStartItem->idealSize().width(), 0);
@@ -124,8 +124,8 @@ QPointF Arrow::startPoint()
  */
 QPointF Arrow::midPoint()
 {
-    QPointF startLT = mapFromItem(myStartItem, 0, 0);
-    QPointF endLT = mapFromItem(myEndItem, 0, 0);
+    QPointF startLT = mapFromParent(myStartItem->posInGroup());
+    QPointF endLT = mapFromParent(myEndItem->posInGroup());
     qreal x;
 
     if (startLT.x() + myStartItem->idealSize().width() + S
@@ -143,7 +143,7 @@ QPointF Arrow::midPoint()
  */
 QPointF Arrow::endPoint() //! TODO
 {
-    return mapFromItem(myEndItem, myEndItem->idealSize().width(),0);
+    return mapFromParent(myEndItem->posInGroup() + QPointF(myEndItem->idealSize().width(), 0));
 }
 
 /**
@@ -0,0 +1,617 @@
+/**
+* @file benchmark.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class Benchmark and it's functions and identifiers.
+*/
+
+#include "benchmark.h"
+#include "block_group.h"
+#include "block.h"
+#include "tree_element.h"
+#include "document_scene.h"
+#include "tree_snapshot.h"
+
+#include <QDebug>
+#include <QAtomicInt>
+#include <QPointer>
+
+const int KEYSTROKES = 1000; // simulated keystrokes of one measurement
+const int MAX_SCANNED_SIBLINGS = 20000; // old quadratic sibling scan is measured on this many blocks only
+const int DEEP_NESTING = 100000; // levels of tree in nesting benchmark
+const int FIRST_ANALYZED_NESTING = 64; // nested C blocks of first analysis, doubled while parser accepts them
+
+#if defined(BENCHMARK_ALLOCATIONS) && defined(__GLIBC__)
+static QAtomicInt allocations;  //! heap allocations of whole program
+
+// Qt containers allocate with malloc/realloc, operator new ends in malloc too
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) __THROW
+{
+    allocations.ref();
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) __THROW
+{
+    allocations.ref();
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) __THROW
+{
+    allocations.ref();
+    return __libc_realloc(ptr, size);
+}
+}
+
+static int allocationCount() {return allocations;}
+#else
+static int allocationCount() {return -1;}   //! allocations are not counted
+#endif
+
+/**
+ * Old getDescendants(), list is built at every level and concatenated upward.
+ * Kept here only as baseline of traversal benchmark.
+ */
+static QList<TreeElement*> listDescendants(const TreeElement *element)
+{
+    QList<TreeElement*> list;
+
+    foreach (TreeElement *child, element->childList())
+    {
+        list << child;
+        list += listDescendants(child);
+    }
+
+    return list;
+}
+
+// counts visited elements
+class CountingVisitor : public TreeVisitor
+{
+public:
+    CountingVisitor() {count = 0;}
+    bool visit(TreeElement *element) {Q_UNUSED(element); count++; return true;}
+
+    int count;
+};
+
+Benchmark::Benchmark(BlockGroup *group)
+{
+    this->group = group;
+}
+
+/**
+ * Run all measurements on the group, returns one line per result.
+ */
+QString Benchmark::run()
+{
+    results.clear();
+
+    if (group == 0 || group->mainBlock() == 0)
+        return QString();
+
+    results << QString("document: %1 lines").arg(group->getLastLine() + 1);
+    searchClearing();
+    traversal();
+    layout();
+    sceneItems();
+    foldedTeardown();
+    moveAcrossContexts();
+    foldAfterNewLine();
+    deepNesting();
+    group->update();
+
+    return results.join("\n");
+}
+
+/**
+ * Flat C file with given count of top level statements, one per line,
+ * followed by one function, so the file has blocks to fold.
+ */
+QString Benchmark::generateC(int statements)
+{
+    QString text;
+    text.reserve(statements * 24 + 128);
+
+    for (int i = 0; i < statements; i++)
+        text.append(QString("int value%1 = %2;\n").arg(i).arg(i % 100));
+
+    text.append("int main()\n{\n    int i;\n    int sum = 0;\n"
+                "    for (i = 0; i < 100; i++)\n    {\n        sum += value0;\n    }\n"
+                "    return sum;\n}\n");
+
+    return text;
+}
+
+/**
+ * C function with body of nested blocks {{...}}, depth levels deep.
+ */
+static QString generateNestedC(int depth)
+{
+    QString text;
+    text.reserve(depth * 2 + 32);
+    text.append("int main()\n{\n");
+    text.append(QString().fill('{', depth));
+    text.append(QString().fill('}', depth));
+    text.append("\n}\n");
+
+    return text;
+}
+
+/**
+ * Cost of clearing search results. Keystrokes without marked results return
+ * at once, old clearing did the same. First clearing after a search walked
+ * whole tree before, now only marked blocks are touched.
+ */
+void Benchmark::searchClearing()
+{
+    TreeElement *rootEl = group->mainBlock()->getElement();
+    group->clearSearchResults();
+
+    time.start();
+
+    for (int i = 0; i < KEYSTROKES; i++)
+        group->clearSearchResults();    //! nothing marked, returns at once
+
+    report("clear search, nothing marked (old and new)", time.elapsed(),
+           QString("%1 keystrokes").arg(KEYSTROKES));
+
+    // mark all blocks of most common token, first leaf of generated file
+    TreeElement *leaf = rootEl->firstLeaf();
+
+    if (leaf == 0) return;
+
+    QString token = leaf->getType();
+
+    // old clearing after a search: walk of whole tree, unmarking every block
+    group->searchBlocks(token, false, true);
+    int elements = 0;
+    time.start();
+
+    for (TreeElement *el = rootEl; el->hasNext(); el = el->next())
+    {
+        Block *bl = el->getBlock();
+
+        if (bl != 0) bl->setYellow(false);
+
+        elements++;
+    }
+
+    report("clear search after search, tree walk (old)", time.elapsed(),
+           QString("%1 elements").arg(elements));
+    group->clearSearchResults();
+
+    // new clearing after a search: marked blocks only
+    group->searchBlocks(token, false, true);
+    time.start();
+    group->clearSearchResults();
+    report("clear search after search, marked blocks (new)", time.elapsed(),
+           "all \"" + token + "\" marked");
+}
+
+/**
+ * Time and allocations of one walk over whole tree, old list building
+ * against the allocation-free traversal API.
+ */
+void Benchmark::traversal()
+{
+    TreeElement *rootEl = group->mainBlock()->getElement();
+    int count = 0;
+    int before = allocationCount();
+    time.start();
+    count = listDescendants(rootEl).size();
+    reportWalk("descendants, list per level (old)", count, before);
+
+    before = allocationCount();
+    time.start();
+    count = rootEl->getDescendants().size();
+    reportWalk("getDescendants(), one list", count, before);
+
+    count = 0;
+    before = allocationCount();
+    time.start();
+
+    for (TreeElement *el = rootEl->nextDescendant(rootEl); el != 0; el = el->nextDescendant(rootEl))
+        count++;
+
+    reportWalk("nextDescendant() loop", count, before);
+
+    CountingVisitor visitor;
+    before = allocationCount();
+    time.start();
+    rootEl->visitDescendants(&visitor);
+    reportWalk("visitDescendants()", visitor.count, before);
+
+    count = 0;
+    before = allocationCount();
+    time.start();
+
+    for (TreeElement *el = rootEl->firstLeaf(); el != 0; el = el->nextLeaf(rootEl))
+        count++;
+
+    reportWalk("firstLeaf()/nextLeaf() loop", count, before);
+}
+
+/**
+ * Full layout of the document against the old sibling scan. Old updatePos()
+ * listed all children and scanned them up to previous sibling for every
+ * block after a line break, which is quadratic in count of siblings.
+ */
+void Benchmark::layout()
+{
+    Block *root = group->mainBlock();
+    int lines = group->getLastLine() + 1;
+
+    time.start();
+    root->updateBlock(false);
+    int ms = time.elapsed();
+    report("full layout", ms, QString("%1 lines, %2 ms per 10000 lines")
+           .arg(lines).arg(lines > 0 ? ms * 10000.0 / lines : 0.0, 0, 'f', 1));
+
+    // old max bottom search of updatePos(), children of root only
+    QList<Block*> siblings = root->childBlocks();
+    int scanned = qMin(siblings.size(), MAX_SCANNED_SIBLINGS);
+    qreal sum = 0;
+    time.start();
+
+    for (int i = 1; i < scanned; i++)
+    {
+        Block *prevSib = siblings.at(i - 1);
+
+        if (!prevSib->getElement()->isLineBreaking()) continue;
+
+        qreal maxY = 0;
+
+        foreach (Block *child, root->childBlocks())
+        {
+            qreal y = child->idealPos().y() + child->idealSize().height();
+
+            if (y > maxY) maxY = y;
+
+            if (child == prevSib) break;
+        }
+
+        sum += maxY;    //! keeps the loop from being optimized out
+    }
+
+    report("sibling max bottom scan (old)", time.elapsed(),
+           QString("first %1 of %2 root children").arg(scanned).arg(siblings.size()));
+
+    // new running bottom: real layout path, every following sibling of first
+    // root child is moved by updateAfter() using bottom of its previous sibling
+    Block *first = root->getFirstChild();
+
+    if (first != 0)
+    {
+        time.start();
+        first->updateAfter(false);
+        report("updateAfter() of first root child (new)", time.elapsed(),
+               QString("%1 following siblings").arg(siblings.size() - 1));
+    }
+
+    if (sum < 0) qDebug() << sum;
+}
+
+/**
+ * Count of scene items against count of blocks. Blocks far from viewport
+ * are out of scene, so items depend on size of the window, not of the document.
+ */
+void Benchmark::sceneItems()
+{
+    int blocks = 0;
+    QList<Block*> stack;
+    stack.append(group->mainBlock());
+
+    while (!stack.isEmpty())
+    {
+        Block *block = stack.takeLast();
+        blocks++;
+
+        for (Block *child = block->getFirstChild(); child != 0; child = child->getNextSibling())
+            stack.append(child);
+    }
+
+    time.start();
+    group->docScene->updateViewport();
+    int ms = time.elapsed();
+
+    report("viewport update", ms, QString("%1 scene items, %2 blocks")
+           .arg(group->docScene->items().size()).arg(blocks));
+}
+
+/**
+ * Deleting a folded block has to free its AST too, folded block has no
+ * child blocks that would delete it. Copy of last foldable top level block
+ * is built outside of the document, folded and deleted, all elements
+ * of the copy must be gone.
+ */
+void Benchmark::foldedTeardown()
+{
+    QList<Block*> children = group->mainBlock()->childBlocks();
+    Block *foldable = 0;
+
+    for (int i = children.size() - 1; i >= 0 && foldable == 0; i--)
+    {
+        if (children.at(i)->isFoldable() && !children.at(i)->isFolded())
+            foldable = children.at(i);
+    }
+
+    if (foldable == 0)
+    {
+        report("delete folded block", 0, "no foldable block");
+        return;
+    }
+
+    TreeElement *copy = foldable->getElement()->clone();
+    int elements = copy->getDescendants().size() + 1;
+    Block *block = new Block(copy, 0, group);   //! not linked to document
+    block->setFolded(true);
+
+    int before = TreeElement::instanceCount();
+    time.start();
+    delete block;
+    int ms = time.elapsed();
+    int freed = before - TreeElement::instanceCount();
+
+    report(freed == elements ? "delete folded block" : "delete folded block LEAKS", ms,
+           QString("%1 of %2 elements freed").arg(freed).arg(elements));
+}
+
+/**
+ * Move first top level block to the end of statement list in last foldable
+ * block (function of generated file) and back. Moves splice existing blocks,
+ * so after each move tree must still be the same as analysis of the text.
+ */
+void Benchmark::moveAcrossContexts()
+{
+    Block *root = group->mainBlock();
+    QPointer<Block> moved = root->getFirstChild();
+    Block *function = 0;
+
+    for (Block *child = root->getFirstChild(); child != 0; child = child->getNextSibling())
+    {
+        if (child->isFoldable() && !child->isFolded())
+            function = child;
+    }
+
+    // statement list: block with most children, all of them compound
+    Block *body = 0;
+    int bodySize = 0;
+    QList<Block*> stack;
+
+    if (function != 0)
+        stack.append(function);
+
+    while (!stack.isEmpty())
+    {
+        Block *block = stack.takeLast();
+        int size = 0;
+        bool compound = true;
+
+        for (Block *child = block->getFirstChild(); child != 0; child = child->getNextSibling())
+        {
+            compound = compound && !child->isTextBlock();
+            size++;
+            stack.append(child);
+        }
+
+        if (compound && size > bodySize)
+        {
+            body = block;
+            bodySize = size;
+        }
+    }
+
+    if (body == 0 || moved == function)
+    {
+        report("move block across contexts", 0, "no statement list to move into");
+        return;
+    }
+
+    Block *oldNext = moved->getNextSibling();
+
+    time.start();
+    bool done = group->moveBlock(moved, body, 0, true);
+    int ms = time.elapsed();
+    report("move block into function", ms, !done ? "refused"
+           : matchesAnalysis() ? "tree matches analysis" : "tree DIFFERS from analysis");
+
+    if (moved.isNull() || moved->parentBlock() != body || oldNext == 0)
+        return;     //! end was reanalyzed, block was replaced
+
+    time.start();
+    done = group->moveBlock(moved, root, oldNext, true);
+    ms = time.elapsed();
+    report("move block back to top level", ms, !done ? "refused"
+           : matchesAnalysis() ? "tree matches analysis" : "tree DIFFERS from analysis");
+}
+
+/**
+ * New line is inserted after first top level block and removed again. Fold
+ * button of last foldable block must follow it to its new line and back.
+ */
+void Benchmark::foldAfterNewLine()
+{
+    Block *root = group->mainBlock();
+    Block *first = root->getFirstChild();
+    Block *foldable = 0;
+
+    for (Block *child = root->getFirstChild(); child != 0; child = child->getNextSibling())
+    {
+        if (child->isFoldable() && !child->isFolded())
+            foldable = child;
+    }
+
+    if (foldable == 0 || foldable == first)
+    {
+        report("fold button after new line", 0, "no foldable block");
+        return;
+    }
+
+    int line = foldable->getLine();
+    bool owned = group->getFoldableIn(line) == foldable;
+
+    time.start();
+    group->splitLine(first->getLastLeaf(), -1);    //! enter at end of first line
+    int ms = time.elapsed();
+    bool moved = foldable->getLine() == line + 1 && group->getFoldableIn(line + 1) == foldable
+            && group->getFoldableIn(line) != foldable;
+    report("fold button after new line", ms, !owned ? "not owner before"
+           : moved ? "owner moved to next line" : "owner STALE");
+
+    Block *inserted = first->getNextSibling();
+
+    if (inserted == 0 || inserted == foldable) return;
+
+    time.start();
+    Block *next = inserted->removeBlock(true);
+
+    if (next != 0) next->updateAfter(false);
+
+    ms = time.elapsed();
+    moved = foldable->getLine() == line && group->getFoldableIn(line) == foldable;
+    report("fold button after removed line", ms, moved ? "owner moved back" : "owner STALE");
+}
+
+/**
+ * Returns true if whole tree is the same as analysis of document text.
+ */
+/**
+ * Walks over DEEP_NESTING levels of nesting. Tree is built directly, not by
+ * the grammar, and has no blocks: getText, snapshot, clone and teardown (with
+ * release of snapshot nodes) must not recurse. Analysis is measured on nested C blocks, depth is doubled
+ * until the parser rejects it (parser shows its error once).
+ * Still recursive, so not measured on this depth:
+ * - QGraphicsItem paints, maps and deletes nested Blocks through their
+ *   parent items inside Qt, so depth of blocks is bounded by Qt
+ * - LPeg matches and builds captures of nested rules recursively in C and
+ *   limits its backtrack stack, so depth of analysed text is bounded by LPeg
+ */
+void Benchmark::deepNesting()
+{
+    int before = TreeElement::instanceCount();
+    TreeElement *root = new TreeElement("program", true);
+    TreeElement *parent = root;
+
+    for (int i = 0; i < DEEP_NESTING; i++)
+    {
+        TreeElement *block = new TreeElement("block", true);
+        parent->appendChild(new TreeElement("{"));
+        parent->appendChild(block);
+        parent->appendChild(new TreeElement("}"));
+        parent = block;
+    }
+
+    parent->appendChild(new TreeElement("0"));
+    int elements = TreeElement::instanceCount() - before;
+    QString depth = QString("%1 levels").arg(DEEP_NESTING);
+
+    time.start();
+    QString text = root->getText();
+    report(text.length() == DEEP_NESTING * 2 + 1 ? "deep getText" : "deep getText WRONG",
+           time.elapsed(), depth);
+
+    time.start();
+    TreeSnapshot *snapshot = new TreeSnapshot(root);
+    report("deep snapshot", time.elapsed(), depth);
+
+    time.start();
+    bool same = snapshot->getText() == text;
+    delete snapshot;    //! nodes are kept by elements, released in teardown
+    report(same ? "deep snapshot text" : "deep snapshot text WRONG", time.elapsed(), depth);
+
+    time.start();
+    TreeElement *copy = root->clone();
+    report("deep clone", time.elapsed(), depth);
+
+    time.start();
+    copy->deleteAllChildren();
+    delete copy;
+    root->deleteAllChildren();
+    delete root;
+    int freed = elements * 2 - (TreeElement::instanceCount() - before);
+    report(freed == elements * 2 ? "deep teardown (original + clone)" : "deep teardown LEAKS",
+           time.elapsed(), QString("%1 of %2 elements freed").arg(freed).arg(elements * 2));
+
+    // analysis, deepest nesting accepted by the grammar
+    if (group->getAnalyzer()->getLanguageName() != "C")
+    {
+        report("deep analysis", 0, "document is not C");
+        return;
+    }
+
+    int accepted = 0;
+    int ms = 0;
+
+    for (int nesting = FIRST_ANALYZED_NESTING; nesting <= DEEP_NESTING; nesting *= 2)
+    {
+        QString input = generateNestedC(nesting);
+        time.start();
+        TreeElement *parsed = group->getAnalyzer()->analyzeFull(input);
+        int parseMs = time.elapsed();
+
+        if (parsed == 0) break;
+
+        same = parsed->getText() == input;
+        parsed->deleteAllChildren();
+        delete parsed;
+
+        if (!same) break;
+
+        ms = parseMs;
+        accepted = nesting;
+    }
+
+    report(accepted > 0 ? "deep analysis" : "deep analysis FAILED", ms,
+           QString("%1 nested blocks accepted").arg(accepted));
+}
+
+bool Benchmark::matchesAnalysis()
+{
+    TreeElement *rootEl = group->mainBlock()->getElement()->getRoot();
+    TreeElement *parsed = group->getAnalyzer()->analyzeFull(group->toText());
+
+    if (parsed == 0) return false;
+
+    bool same = parsed->childCount() == rootEl->childCount();
+
+    for (int i = 0; same && i < rootEl->childCount(); i++)
+        same = rootEl->child(i)->sameTree(parsed->child(i));
+
+    parsed->deleteAllChildren();
+    delete parsed;
+
+    return same;
+}
+
+void Benchmark::reportWalk(QString name, int elements, int allocationsBefore)
+{
+    int ms = time.elapsed();
+    int allocated = allocationCount() - allocationsBefore;
+    QString detail = QString("%1 elements").arg(elements);
+
+    if (allocationsBefore >= 0)
+        detail += QString(", %1 allocations").arg(allocated);
+
+    report(name, ms, detail);
+}
+
+void Benchmark::report(QString name, int ms, QString detail)
+{
+    QString line = QString("%1: %2 ms").arg(name).arg(ms);
+
+    if (!detail.isEmpty())
+        line += " (" + detail + ")";
+
+    qDebug() << "benchmark" << qPrintable(line);
+    results << line;
+}
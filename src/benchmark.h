@@ -0,0 +1,50 @@
+/**
+ * benchmark.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class Benchmark and it's funtions and identifiers
+ *
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QString>
+#include <QStringList>
+#include <QTime>
+
+class BlockGroup;
+
+/**
+ * Timings of editor operations on the selected document, run from
+ * Tools > Benchmark. Old behaviour is measured next to the new one in the
+ * same build, so results compare before and after. Documents of any size
+ * can be generated by generateC(), results are printed with qDebug.
+ * Heap allocations are counted in builds with BENCHMARK_ALLOCATIONS (glibc only).
+ */
+class Benchmark
+{
+public:
+    Benchmark(BlockGroup *group);
+
+    QString run();
+    static QString generateC(int statements);
+
+private:
+    void searchClearing();
+    void traversal();
+    void layout();
+    void sceneItems();
+    void foldedTeardown();
+    void moveAcrossContexts();
+    void foldAfterNewLine();
+    void deepNesting();
+    bool matchesAnalysis();
+    void reportWalk(QString name, int elements, int allocationsBefore);
+    void report(QString name, int ms, QString detail = QString());
+
+    BlockGroup *group;
+    QStringList results;
+    QTime time;
+};
+
+#endif // BENCHMARK_H
@@ -25,8 +25,35 @@
  */
 Block::Block(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
     : QGraphicsRectItem(parentBlock)
+{
+    initBlock(el, parentBlock, blockGroup);
+    buildTree();
+}
+
+/**
+ * Constructor used by buildTree(), creates only this block,
+ * children and final setup are done by buildTree() of the topmost block.
+ */
+Block::Block(TreeElement *el, Block *parentBlock, InitMode mode)
+    : QGraphicsRectItem(parentBlock)
+{
+    Q_UNUSED(mode);
+    initBlock(el, parentBlock, 0);
+}
+
+/**
+ * Set links, element and text area of new block.
+ */
+void Block::initBlock(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
 {
     repaintNeeded = false;
+    folded = false;
+    bottom = 0;
+    childrenValid = false;
+    keepTextItem = false;
+    asleep = false;
+    myTextItem = 0;
+    staticText = 0;
 
     if (parentBlock == 0) //! adding directly to group, no parent block
     {
@@ -43,25 +70,21 @@ Block::Block(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
         // destroy text item if needed
         if (parent->isTextBlock())
         {
-            delete parent->myTextItem;
-            parent->myTextItem = 0;
+            parent->releaseText();
+            parent->textBlock = false;
         }
 
         group = parent->group;
 
-        // set links
-        QList<Block*> siblings = parent->childBlocks();
+        // set links (append after last linked child)
+        prevSib = parent->getLastChild();
 
-        if (siblings.size() > 1) //! this block is in siblings already!
-        {
-            prevSib = siblings.at(siblings.size() - 2);
+        if (prevSib != 0)
             prevSib->nextSib = this;
-        }
         else
-        {
             parent->firstChild = this;
-            prevSib = 0;
-        }
+
+        parent->children.append(this);  //! keeps ordered children valid
 
         if (el->getParent() == 0)
         {
@@ -82,29 +105,54 @@ Block::Block(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
         element = (*element)[0];
 
     element->setBlock(this);
+    textFormat = group->docScene->getDefaultFormat();
 
     // process rest of the AST
-    if (element->isLeaf()) //! leaf - create text area
+    if (element->isLeaf()) //! leaf - painted by paint(), text area is created when edited
     {
-        //qDebug() << "text " << element->getType() << " par: " << element->allowsParagraphs()  ;
-        myTextItem = new TextItem(element->getType(), this, element->allowsParagraphs(), element->isPaired());
-        //qDebug() << "this " << myTextItem;
+        textBlock = true;
     }
-    else //! non-leaf - create rest of the tree
+    else //! non-leaf - rest of the tree is created by buildTree()
     {
-        myTextItem = 0;
+        textBlock = false;
         setToolTip(element->getType().replace("_", " "));
+    }
+}
+
+/**
+ * Create blocks for all descendants of my element. Uses explicit stack
+ * instead of recursion, so deeply nested documents can't overflow the call stack.
+ * Blocks are created and finished in the same order as recursive construction would.
+ */
+void Block::buildTree(bool finishThis)
+{
+    group->sleepPending = true;     //! new blocks are in scene until next updateViewport()
+    QList<QPair<Block*, int> > stack;   //! unfinished blocks + next child index
+    stack.append(qMakePair(this, 0));
+
+    while (!stack.isEmpty())
+    {
+        QPair<Block*, int> &top = stack.last();
+        Block *block = top.first;
 
-       // int child_count = element->childCount();
-        QList<TreeElement*> children = element->getChildren();
-       // for (int i = 0; i < child_count; i++)children.size()
-       for (int i = 0; i < children.size(); i++)
+        if (!block->isTextBlock() && top.second < block->element->childCount())
         {
-          //  qDebug() << "child_count " << child_count <<"  size() "<< children.size() << " element:"<< element->getType();
-            TreeElement *childEl = children[i];
+            TreeElement *childEl = (*block->element)[top.second++];
+
             if (!childEl->isFloating()) //! create block from child element
             {
-                new Block(childEl, this);
+                stack.append(qMakePair(new Block(childEl, block, InitOnly), 0));
+            }
+            else if (childEl->getBlock() != 0) //! docblock kept while I was folded
+            {
+                DocBlock *docBl = qgraphicsitem_cast<DocBlock*>(childEl->getBlock());
+                Block *target = block->getLastChild();
+
+                if (docBl != 0)
+                {
+                    docBl->parent = block;
+                    docBl->addArrowTo(target != 0 ? target : block);
+                }
             }
             else //! create docblock form child element
             {
@@ -114,19 +162,71 @@ Block::Block(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
                }else{
                     QString text = childEl->getText();
                     childEl->deleteAllChildren();
-                    new DocBlock(text, childEl, this, group);
+                    new DocBlock(text, childEl, block, block->group);
                }
             }
         }
+        else
+        {
+            stack.removeLast();
+
+            if (block != this || finishThis)
+                block->finishBlock();
+        }
+    }
+}
+
+/**
+ * Destroy all my descendant blocks, their elements stay in AST and the blocks
+ * are built again by buildTree(). Docblocks pointing inside point to me.
+ */
+void Block::releaseChildren()
+{
+    foreach (DocBlock *docBl, group->docBlocks())
+    {
+        Block *target = docBl->targetBlock();
+
+        if (target != 0 && isAncestorOf(target))
+            docBl->addArrowTo(this);
+
+        if (docBl->parent != 0 && isAncestorOf(docBl->parent))
+            docBl->parent = this;
+    }
+
+    QList<Block*> stack = orderedChildren().toList();
+    QList<Block*> top = stack;
+
+    while (!stack.isEmpty())
+    {
+        Block *block = stack.takeLast();
+
+        for (Block *child = block->firstChild; child != 0; child = child->nextSib)
+            stack.append(child);
+
+        if (block->myTextItem != 0)
+            block->releaseText();
+
+        group->removeFoldable(block);
+        block->element->setBlock(0);
+        block->element = 0;     //! element stays in AST
     }
 
+    firstChild = 0;
+    childrenValid = false;
+    qDeleteAll(top);    //! descendants are deleted as child items
+}
+
+/**
+ * Final setup of block, called when all its children exist.
+ */
+void Block::finishBlock()
+{
     // set highlighting
     assignHighlighting(element);
 
     // set flags
     setAcceptedMouseButtons(Qt::LeftButton);
     setAcceptDrops(true);
-    folded = false;
     edited = false;
     showing = false;
     moreSpace = false;
@@ -135,21 +235,12 @@ Block::Block(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
     isSearchResult = false;
     foldButton = 0;
     level = 0;
-
-    animation = new QPropertyAnimation(this, "geometry");
-    animation->setDuration(200);
+    timer = 0;      //! hover timer is created on first use
 
     if (element->isSelectable())
     {
         setPen(QPen(QBrush(Qt::black), 2));
         setAcceptHoverEvents(true);
-        timer = new QTimer(this);
-        timer->setSingleShot(true);
-        connect(timer, SIGNAL(timeout()), this, SLOT(acceptHover()));
-    }
-    else
-    {
-        timer = 0;
     }
 
     // set size
@@ -163,48 +254,108 @@ Block::Block(TreeElement *el, Block *parentBlock, BlockGroup *blockGroup)
 
 Block::~Block()
 {
+    deleteFoldedElements();
+
     delete element;
+    deleteDescendants();
+    delete staticText;
+}
+
+/**
+ * Delete descendant blocks without recursion, QGraphicsItem would delete them
+ * recursively as child items. Elements are deleted top-down first (as recursive
+ * delete would), then blocks bottom-up, so every block dies without child blocks.
+ */
+void Block::deleteDescendants()
+{
+    QList<Block*> blocks;   //! descendants, each after its parent
+
+    for (int i = -1; i < blocks.size(); i++)
+    {
+        Block *block = (i < 0) ? this : blocks.at(i);
+
+        for (Block *child = block->firstChild; child != 0; child = child->nextSib)
+            blocks.append(child);   //! sleeping children are not child items
+
+        foreach (QGraphicsItem *item, block->childItems())
+        {
+            Block *child = qgraphicsitem_cast<Block*>(item);
+
+            if (child != 0 && child->parent != block)
+                blocks.append(child);   //! child item without links
+        }
+    }
+
+    foreach (Block *block, blocks)
+    {
+        block->deleteFoldedElements();
+        delete block->element;
+        block->element = 0;
+    }
+
+    while (!blocks.isEmpty())
+    {
+        Block *block = blocks.takeLast();
+        block->firstChild = 0;  //! its children are deleted already
+        delete block;
+    }
+}
+
+/**
+ * Delete AST under folded block, it has no child blocks that would delete it.
+ * Elements of docblocks are only detached, docblocks delete them.
+ */
+void Block::deleteFoldedElements()
+{
+    if (!folded || firstChild != 0 || element == 0)
+        return;
+
+    foreach (TreeElement *el, element->getDescendants())
+    {
+        if (el->getBlock() != 0 && el->getParent() != 0)
+            el->getParent()->removeChild(el);
+    }
+
+    element->deleteAllChildren();
 }
 
 void Block::assignHighlighting(TreeElement *el)
         // todo - remove hardcoded vales such as "declarator"
 {
+    const DocumentScene *scene = group->docScene;
+
     if (el->isLeaf())
     {
-        highlightFormat = group->docScene->getDefaultFormat();
+        const NodeStyle *style = 0;
 
         if (el->getParent())
-        {
-            QString parentType = el->getParent()->getType();
+            style = scene->nodeStyle(el->getParent()->getType());
 
-            if (group->docScene->hasFormatFor(parentType) && !el->getParent()->getType().startsWith("funct_"))
-            {
-                highlightFormat = group->docScene->getFormatFor(parentType);
-            }
-        }
+        if (style != 0 && style->role == NodeStyle::Leafs)
+            highlightFormat = scene->styleAt(style->style);
+        else
+            highlightFormat = scene->getDefaultFormat();
 
         highlight(highlightFormat);
     }
     else
     {
-        if (group->docScene->hasFormatFor(el->getType()))
-        {
-            QPair<QFont, QColor> highlightFormat = group->docScene->getFormatFor(el->getType());
+        const NodeStyle *style = scene->nodeStyle(el->getType());
 
-            if (!el->getType().compare("funct_call"))
-            {
-                getFirstLeaf()->highlight(highlightFormat);
-            }
-            else if (!el->getType().compare("funct_definition"))
+        if (style == 0) return;
+
+        if (style->role == NodeStyle::FunctCall)
+        {
+            getFirstLeaf()->highlight(scene->styleAt(style->style));
+        }
+        else if (style->role == NodeStyle::FunctDefinition)
+        {
+            for (Block *block = firstChild; block != 0; block = block->nextSib)
             {
-                QList<Block*> blocks = childBlocks();
-                foreach(Block* block, blocks)
+                if (block->element->getType() == "declarator")
                 {
-                    if (!block->element->getType().compare("declarator"))
-                    {
-                        block->getFirstLeaf()->highlight(highlightFormat);
-                        break;
-                    }
+                    block->getFirstLeaf()->highlight(scene->styleAt(style->style));
+                    break;
                 }
             }
         }
@@ -271,6 +422,7 @@ void Block::setParentBlock(Block *newParent, Block *nextSibling)
 
     this->parent = 0;
     QGraphicsRectItem::setParentItem(0);
+    asleep = false;     //! out of hierarchy now, new parent brings me to scene
 
     // add to new parent element before nextSibling
     if (newParent != 0)
@@ -301,6 +453,7 @@ void Block::setParentBlock(Block *newParent, Block *nextSibling)
             // update links
             if (nextSibling != 0) //! use nextSibling to update links
             {
+                newParent->childrenValid = false;
                 prevSib = nextSibling->prevSib;
 
                 if (prevSib != 0)
@@ -317,18 +470,14 @@ void Block::setParentBlock(Block *newParent, Block *nextSibling)
             }
             else //! use newParent to update links
             {
-                QList<Block*> siblings = newParent->childBlocks();
+                prevSib = newParent->getLastChild();
 
-                if (siblings.size() > 0) //! NOTE: this block is not in siblings yet!
-                {
-                    prevSib = siblings.at(siblings.size() - 1);
+                if (prevSib != 0)
                     prevSib->nextSib = this;
-                }
                 else
-                {
                     newParent->firstChild = this;
-                    prevSib = 0;
-                }
+
+                newParent->children.append(this);   //! keeps ordered children valid
 
                 nextSib = 0;
                 // adjust line breaks when appending a linebreaking element
@@ -340,10 +489,10 @@ void Block::setParentBlock(Block *newParent, Block *nextSibling)
                 }
             }
             // remove textItem if needed
-            if (newParent->myTextItem != 0)
+            if (newParent->isTextBlock())
             {
-                delete newParent->myTextItem;
-                newParent->myTextItem = 0;
+                newParent->releaseText();
+                newParent->textBlock = false;
             }
         }
         else
@@ -396,7 +545,7 @@ Block *Block::removeBlock(bool deleteThis)
         toDelete.removeOne(this);                  //! top block (this) is not destroyed
     }
 
-    if (!toDelete.contains(next))
+    if (next != 0 && !toDelete.contains(next))
     {
         if (changeSelected && toRemove != 0)       //! reselect if needed
             group->selectBlock(toRemove);
@@ -439,6 +588,9 @@ void Block::removeLinks()
     if (parent != 0 && parent->firstChild == this)
         parent->firstChild = nextSib;
 
+    if (parent != 0)
+        parent->childrenValid = false;
+
     prevSib = nextSib = 0;
 }
 
@@ -459,14 +611,67 @@ Block *Block::getLastLeaf() const
 {
     if (isTextBlock()) return const_cast<Block*>(this);
 
-    Block *block = childBlocks().last();
+    Block *block = getLastChild();
 
     while (!block->isTextBlock())
-        block = block->childBlocks().last();
+        block = block->getLastChild();
 
     return block;
 }
 
+/**
+ * Returns my children in order of links, array is rebuilt only after links changed.
+ */
+const QVector<Block*> &Block::orderedChildren() const
+{
+    if (!childrenValid)
+    {
+        children.clear();
+
+        for (Block *child = firstChild; child != 0; child = child->nextSib)
+            children.append(child);
+
+        childrenValid = true;
+    }
+
+    return children;
+}
+
+Block *Block::getLastChild() const
+{
+    const QVector<Block*> &list = orderedChildren();
+
+    return list.isEmpty() ? 0 : list.last();
+}
+
+/**
+ * Returns first child containing given line (relative to my first line), 0 if none.
+ * Children are ordered by lines, so binary search is used. A child ends where its
+ * next sibling starts (one line before if the child is line breaking).
+ */
+Block *Block::getChildInLine(int line) const
+{
+    const QVector<Block*> &list = orderedChildren();
+
+    if (list.isEmpty() || list.first()->line > line) return 0;
+
+    int low = 0, high = list.size() - 1;    //! last child ends with me
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        Block *child = list.at(mid);
+        int end = list.at(mid + 1)->line - (child->element->isLineBreaking() ? 1 : 0);
+
+        if (end >= line)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    return list.at(low);
+}
+
 Block *Block::getAncestorWhereFirst() const
 {
     Block *block = const_cast<Block*>(this);
@@ -495,13 +700,11 @@ Block *Block::getNext(bool textOnly) const
 {
     Block *next = const_cast<Block*>(this);
 
-    if (parent != 0)
-    {
-        if (nextSib == 0)
-            return parent->getNext(textOnly);
+    while (next->parent != 0 && next->nextSib == 0)
+        next = next->parent;
 
-        next = nextSib;
-    }
+    if (next->parent != 0)
+        next = next->nextSib;
 
     if (textOnly)
         return next->getFirstLeaf();
@@ -513,13 +716,11 @@ Block *Block::getPrev(bool textOnly) const
 {
     Block *prev = const_cast<Block*>(this);
 
-    if (parent != 0)
-    {
-        if (prevSib == 0)
-            return parent->getPrev(textOnly);
+    while (prev->parent != 0 && prev->prevSib == 0)
+        prev = prev->parent;
 
-        prev = prevSib;
-    }
+    if (prev->parent != 0)
+        prev = prev->prevSib;
 
     if (textOnly)
     {
@@ -547,45 +748,52 @@ Block *Block::getFirstSelectableAncestor() const
 
 int Block::numberOfLines() const
 {
-    if (isTextBlock())
-    {
-        return myTextItem->document()->lineCount();
-    }
-    else
+    // lines up to the end of my last leaf, lines of descendants are relative
+    const Block *block = this;
+    int lines = 0;
+
+    while (!block->isTextBlock())
     {
-        Block *last = childBlocks().last();
-        return (last->line + last->numberOfLines() - 1) - this->line + 1;
+        block = block->getLastChild();
+        lines += block->line;
     }
+
+    return lines + block->textLineCount();
 }
 
 bool Block::hasMoreLines() const
 {
-    if (isTextBlock())
-    {
-        return myTextItem->document()->lineCount() > 1;
-    }
-    else
+    const Block *block = this;
+
+    while (!block->isTextBlock())
     {
-        Block *last = childBlocks().last();
-        return (last->line > this->line) || last->hasMoreLines();
+        Block *last = block->getLastChild();
+
+        if (last->line > 0) return true;   //! starts below its parent
+
+        block = last;
     }
+
+    return block->textLineCount() > 1;
 }
 
 int Block::getLineAfter(QPointF pos) const
 {
-    if (!hasMoreLines()) return line;
+    const Block *block = this;
 
-    QPair<Block*, bool> targetRight = findClosestChild(pos);    //! - QPointF(0, group->CHAR_HEIGHT/2.0));
-    Block *target = targetRight.first;
+    while (block->hasMoreLines())
+    {
+        QPair<Block*, bool> targetRight = block->findClosestChild(pos);    //! - QPointF(0, group->CHAR_HEIGHT/2.0));
+        Block *target = targetRight.first;
 
-    if (target == 0)
-        return getLastLeaf()->line;
+        if (target == 0)
+            return block->getLastLeaf()->getLine();
 
-    if (!target->hasMoreLines())
-        return target->line;
-    else
-        return target->getLineAfter(target->mapFromParent(pos));
+        pos = target->mapFromParent(pos);
+        block = target;
+    }
 
+    return block->getLine();
 }
 
 //void Block::addBlockInLine(Block *block, QPointF pos)
@@ -612,21 +820,22 @@ Block *Block::addTextCursorAt(QPointF pos)
 {
     if (isTextBlock()) //! add cursor to this block
     {
-        pos = mapToItem(myTextItem, pos);   //! map to my TextItem
+        TextItem *item = textItem();
+        pos = mapToItem(item, pos);   //! map to my TextItem
         int cursorPos;
 
         // find cursor position:
         if (element->allowsParagraphs()) //! use slow hitTest for multiline blocks only
         {
-            cursorPos = myTextItem->document()->documentLayout()->hitTest(pos, Qt::FuzzyHit);
+            cursorPos = item->document()->documentLayout()->hitTest(pos, Qt::FuzzyHit);
         }
         else //! use calculation for other blocks
         {
             cursorPos = pos.x() / group->CHAR_WIDTH;
         }
         // set cursor position
-        if (cursorPos < 0 || !myTextItem->setTextCursorPos(cursorPos))
-            myTextItem->setTextCursorPos(0);
+        if (cursorPos < 0 || !item->setTextCursorPos(cursorPos))
+            item->setTextCursorPos(0);
 
         return this;    //! return block with cursor
     }
@@ -661,24 +870,30 @@ Block *Block::addTextCursorAt(QPointF pos)
 
 QPair<Block*, bool> Block::findClosestLeaf(QPointF pos) const
 {
-    QPair<Block*, bool> targetRight = findClosestChild(pos);
-    Block *target = targetRight.first;
+    const Block *block = this;
 
-    if (target == 0) //! target is after last child
+    while (true)
     {
-        targetRight.first = getLastLeaf();
-        targetRight.second = false;
+        QPair<Block*, bool> targetRight = block->findClosestChild(pos);
+        Block *target = targetRight.first;
 
-        return targetRight;
-    }
+        if (target == 0) //! target is after last child
+        {
+            targetRight.first = block->getLastLeaf();
+            targetRight.second = false;
 
-    if (target->isTextBlock()) //! target is leaf
-    {
-        return targetRight;
-    }
+            return targetRight;
+        }
+
+        if (target->isTextBlock()) //! target is leaf
+        {
+            return targetRight;
+        }
 
-    // non-text target - continue recursively
-    return target->findClosestLeaf(target->mapFromParent(pos));
+        // non-text target - descend
+        pos = target->mapFromParent(pos);
+        block = target;
+    }
     // returns closest leaf descendant and true if it's to right of pos, false if it's to left
     // never returns 0
 }
@@ -689,10 +904,38 @@ QPair<Block*, bool> Block::findClosestChild(QPointF pos) const
     qreal minDistX = idealSize().width(), minDistY = idealSize().height();
     bool siblingIsRight = true;
 
+    // children are ordered by top and keep running max bottom, so only children
+    // between first one ending below pos and last one starting above pos can contain it
+    const QVector<Block*> &list = orderedChildren();
+    int low = 0, high = list.size();
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+
+        if (list.at(mid)->bottom + 1 > pos.y())
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
+    int first = low;
+    high = list.size();
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+
+        if (list.at(mid)->idealGeometry.top() > pos.y())
+            high = mid;
+        else
+            low = mid + 1;
+    }
+
     // test distance from child blocks' hotspots
-    Block *child = firstChild;
-    while (child != 0)
+    for (int i = first; i < low; i++)
     {
+        Block *child = list.at(i);
         QRectF rect = child->idealGeometry;
 
         if (pos.y() >= rect.top() && pos.y() < rect.bottom())
@@ -724,7 +967,6 @@ QPair<Block*, bool> Block::findClosestChild(QPointF pos) const
                 siblingIsRight = false;
             }
         }
-        child = child->nextSib;
     }
     // returns closest child and true if it's to right of pos, false if it's to left
     // if sibling == 0 then siblingIsRight == true
@@ -744,7 +986,7 @@ void Block::textFocusChanged(QFocusEvent* event)// TODO
 
             if (isTextBlock())
             {
-                if (pair != 0)
+                if (pair != 0 && pair->getBlock() != 0)
                 {
                     highlight(pairHighlightFormat);
                     pair->getBlock()->highlight(pairHighlightFormat);
@@ -760,7 +1002,7 @@ void Block::textFocusChanged(QFocusEvent* event)// TODO
 
             if (isTextBlock())
             {
-                if (pair != 0)
+                if (pair != 0 && pair->getBlock() != 0)
                 {
                     highlight(highlightFormat);
                     pair->getBlock()->highlight(pair->getBlock()->highlightFormat);
@@ -772,15 +1014,16 @@ void Block::textFocusChanged(QFocusEvent* event)// TODO
 
 void Block::textChanged()
 {
-    QString text = myTextItem->toPlainText();
+    TextItem *item = myTextItem;    //! kept even if layout update returns item to pool
+    QString text = item->toPlainText();
     bool toUpdate = false;
-    myTextItem->document()->blockSignals(true);
+    item->document()->blockSignals(true);
 
     if (text.isEmpty()) //! delete block
     {
-        if (!(element->isLineBreaking() && getPrev(true)->line != line))
+        if (!(element->isLineBreaking() && getPrev(true)->getLine() != getLine()))
         {
-            if (myTextItem->hasFocus())
+            if (item->hasFocus())
             {
                 showing = false; level = 0;
             }
@@ -790,6 +1033,7 @@ void Block::textChanged()
                 // AND isn't focused
                 // focused blocks will de deleted when they lose focus
                 setVisible(false);
+                item->document()->blockSignals(false);
                 removeBlock(true);
                 group->mainBlock()->updateBlock();
                 return;
@@ -816,7 +1060,7 @@ void Block::textChanged()
         }
         while(!text.isEmpty() && text.at(0).isSpace());
 
-        textItem()->setPlainText(text);
+        item->setPlainText(text);
         toUpdate = true;
     }
 
@@ -839,21 +1083,25 @@ void Block::textChanged()
         {
             foldButton->foldText = text;
         }
-        updateGeometryAfter(group->smoothTextAnimation);
+        updateAfter(group->smoothTextAnimation);
     }
 
-    myTextItem->document()->blockSignals(false);
+    item->document()->blockSignals(false);
 }
 
 bool Block::isEdited() const // returns true if this or its ancestors are edited
 {
-    if (edited || element->isSelectable())
-        return edited;
+    const Block *block = this;
 
-    if (parent == 0)
-        return false;
+    while (!block->edited && !block->element->isSelectable())
+    {
+        if (block->parent == 0)
+            return false;
+
+        block = block->parent;
+    }
 
-    return parent->isEdited();
+    return block->edited;
 }
 
 bool Block::isOverlapPossible() const
@@ -980,10 +1228,10 @@ void Block::hoverEnterEvent(QGraphicsSceneHoverEvent *event)
     }
     else
     {
-        timer->start(HOVER_TIMER);
+        hoverTimer()->start(HOVER_TIMER);
         Block *block = getFirstSelectableAncestor();
 
-        if (block != this)
+        if (block != this && block->timer != 0)
         {
             block->timer->stop();
         }
@@ -999,7 +1247,7 @@ void Block::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
     }
     else
     {
-        timer->stop();
+        if (timer != 0) timer->stop();
         pointed = false;
         repaintNeeded = true;
         update();
@@ -1007,7 +1255,7 @@ void Block::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
 
         if (block != this)
         {
-            block->timer->start(HOVER_TIMER/5);
+            block->hoverTimer()->start(HOVER_TIMER/5);
         }
     }
 }
@@ -1043,28 +1291,12 @@ void Block::updateBlock(bool doAnimation)
         // used to update everything from root down
         // updates line numbers, geometry and foldbutton
 {
-    // update line
-    updateLine();
+    QList<Block*> updated;
+    updateSubtree(doAnimation, updated);
+    // fold buttons need lines of whole document
+    foreach (Block *block, updated)
+        block->updateFoldButton();
 
-    if (parent == 0 || line > group->getLastLine())
-        group->setBlockIn(this, line);
-    // update pos
-    updatePos(!doAnimation);
-    // update children
-    Block *child = firstChild;
-
-    while(child != 0)
-    {
-        child->updateBlock(doAnimation);
-        child = child->nextSib;
-    }
-    // update size
-    updateSize(!doAnimation);
-    // update fold button
-    updateFoldButton();
-    // animate
-    if (doAnimation)
-        animate();
     // root updates group size
     if (parent == 0)
     {
@@ -1074,46 +1306,138 @@ void Block::updateBlock(bool doAnimation)
     }
 }
 
+/**
+ * Update lines and geometry of my subtree, updated blocks are appended
+ * to given list in post-order.
+ */
+void Block::updateSubtree(bool doAnimation, QList<Block*> &updated)
+{
+    QList<Block*> stack;    //! blocks waiting for their children
+    Block *block = this;
+
+    while (true)
+    {
+        if (block != 0)
+        {
+            // update line
+            block->updateLine();
+            // update pos
+            block->updatePos(!doAnimation);
+            // update children
+            stack.append(block);
+            block = block->firstChild;
+            continue;
+        }
+
+        Block *done = stack.takeLast();
+        // update size
+        done->updateSize(!doAnimation);
+        updated.append(done);
+        // animate
+        if (doAnimation)
+            done->animate();
+
+        if (done == this) break;
+
+        block = done->nextSib;
+    }
+}
+
 void Block::updateGeometryAfter(bool doAnimation)
 {
     // used to update everything after this block
     // updates only geometry
-    Block *child = firstChild;
-    // update children's positions
+    Block *block = this;
 
-    while (child != 0)
+    while (true)
     {
-        child->updatePos(!doAnimation);
-        child->updateFoldButton();
+        Block *child = block->firstChild;
+        // update children's positions
+
+        while (child != 0)
+        {
+            child->updatePos(!doAnimation);
+            child->updateFoldButton();
 
-        if (doAnimation) child->animate();  // block animates its children
+            if (doAnimation) child->animate();  // block animates its children
 
-        child = child->nextSib;
+            child = child->nextSib;
+        }
+        // update my size
+        block->updateSize(!doAnimation);
+        // let parent update siblings' and my position together with its size
+        if (block->parent == 0) break;
+
+        block = block->parent;
     }
-    // update my size
-    updateSize(!doAnimation);
-    // let parent update siblings' and my position together with its size
-    if (parent != 0)
+
+    if (doAnimation)     // root must animate itself
+        block->animate();
+
+    group->updateSize(); // root updates group size
+    qDebug("   Geometry updated");
+}
+
+/**
+ * Incremental update after change inside this block. Only my subtree is
+ * updated completely, following blocks are just moved (their descendants
+ * keep relative lines and positions) and ancestors update their sizes.
+ */
+void Block::updateAfter(bool doAnimation)
+{
+    if (parent == 0)
     {
-        parent->updateGeometryAfter(doAnimation);
+        updateBlock(doAnimation);
+        return;
     }
-    else
+
+    QList<Block*> updated;
+    updateSubtree(doAnimation, updated);
+    Block *block = this;
+
+    while (block->parent != 0)
     {
-        if (doAnimation)     // root must animate itself
-            animate();
+        // move following siblings
+        for (Block *next = block->nextSib; next != 0; next = next->nextSib)
+        {
+            qreal oldX = next->idealPos().x();
+            next->updateLine();
+            next->updatePos(!doAnimation);
+
+            // descendants keep relative lines and positions, only my first line
+            // can be shared with blocks from outside and fold button depends on line start
+            if (next->idealPos().x() != oldX || !next->prevSib->element->isLineBreaking())
+                group->updateFoldButtons(next->getLine());
 
-        group->updateSize(); // root updates group size
-        qDebug("   Geometry updated");
+            if (doAnimation) next->animate();
+        }
+
+        block = block->parent;
+        block->updateSize(!doAnimation);
+        updated.append(block);
+
+        if (doAnimation) block->animate();
     }
+
+    foreach (Block *done, updated)
+        done->updateFoldButton();
+
+    group->updateSize();
 }
 
+/**
+ * Move me towards my ideal geometry, the movement itself is driven
+ * by my group together with all other moving blocks.
+ */
 void Block::animate()
 {
-    if (geometry() == idealGeometry) return;
+    if (geometry() == idealGeometry)
+    {
+        group->stopAnimation(this);
+        return;
+    }
 
-    animation->setStartValue(geometry());
-    animation->setEndValue(idealGeometry);
-    animation->start();
+    group->animateBlock(this);
 }
 
 void Block::updateGeometry(bool updateReal)
@@ -1163,21 +1487,9 @@ void Block::updatePos(bool updateReal)
         }
         else
         {
-            qreal maxY = 0;
-            //            qreal offsY = 0;
-            foreach (Block *child, parent->childBlocks())
-            {
-                int y = child->idealPos().y() + child->idealSize().height();
-
-                if (y > maxY)
-                {
-                    maxY = y;
-                    //                    offsY = child->getOffset(Outer).y();
-                }
-                if (child == prevSib) break;
-            }
+            // previous siblings keep running max bottom, no need to visit them
             //            pos.rx() = parent->getOffset(InnnerTopLeft).x();
-            pos.ry() += maxY ;//+ getOffset(Outer).y() + offsY;
+            pos.ry() += prevSib->bottom;//+ getOffset(Outer).y() + offsY;
         }
     }
     else
@@ -1193,6 +1505,7 @@ void Block::updatePos(bool updateReal)
     if (pos != idealPos()) repaintNeeded = true;
 
     idealGeometry.moveTo(pos);
+    updateBottom();
 
     if (updateReal) setPos(pos);
 }
@@ -1203,7 +1516,7 @@ void Block::updateSize(bool updateReal)
 
     if (isTextBlock())
     {
-        size = myTextItem->boundingRect().size();
+        size = textSize();
         size.rwidth() -= 1;
     }
     else
@@ -1235,17 +1548,44 @@ void Block::updateSize(bool updateReal)
     if (size != idealSize()) repaintNeeded = true;
 
     idealGeometry.setSize(size);
+    updateBottom();
 
     if (updateReal)
         setRect(QRectF(QPointF(), size));
 }
 
+/**
+ * Returns my absolute line, lines are kept relative to parent so moving
+ * a block moves all its descendants too.
+ */
+int Block::getLine() const
+{
+    if (element->isFloating()) return line;    //! docblocks are out of hierarchy
+
+    int absolute = line;
+
+    for (Block *block = parent; block != 0; block = block->parent)
+        absolute += block->line;
+
+    return absolute;
+}
+
+/**
+ * Update running max bottom, must be called whenever my ideal geometry changes.
+ * Siblings are laid out in order, so previous sibling's value is up to date.
+ */
+void Block::updateBottom()
+{
+    bottom = int(idealGeometry.bottom()); //! whole pixels, as bottoms were always compared
+
+    if (prevSib != 0 && prevSib->bottom > bottom)
+        bottom = prevSib->bottom;
+}
+
 void Block::updateLine()
 {
     if (prevSib == 0) {
-
-        if (parent == 0) line = 0;
-        else line = parent->line;
+        line = 0;   //! same as parent's first line (root starts at 0)
     }
     else
     {
@@ -1283,19 +1623,31 @@ void Block::highlight(QPair<QFont, QColor> format)
 {
     if (isTextBlock())
     {
-        myTextItem->setFont(format.first);
-        myTextItem->setDefaultTextColor(format.second);
+        setTextFormat(format);
         // NOTE: according to Qt doc this "Sets the color for unformatted text"
         // is this the reason why cursor is colored as well? how to set color for formated text?
     }
     else
     {
-        Block *child = firstChild;
+        // highlight all my leafs, walk by links instead of recursion
+        Block *block = firstChild;
 
-        while (child != 0)
+        while (block != 0)
         {
-            child->highlight(format);
-            child = child->nextSib;
+            if (block->isTextBlock())
+            {
+                block->setTextFormat(format);
+            }
+            else if (block->firstChild != 0)
+            {
+                block = block->firstChild;
+                continue;
+            }
+
+            while (block != this && block->nextSib == 0)
+                block = block->parent;
+
+            block = (block == this) ? 0 : block->nextSib;
         }
     }
 }
@@ -1362,6 +1714,23 @@ void Block::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWi
         painter->fillPath(path, color);
     }
 
+    if (isTextBlock() && myTextItem == 0) //! text of leaf that isn't edited
+    {
+        if (staticText == 0)
+        {
+            staticText = new QStaticText();
+            staticText->setTextFormat(Qt::PlainText);
+            group->watchTextBlock(this);
+        }
+
+        if (staticText->text() != element->getType())
+            staticText->setText(element->getType());
+
+        painter->setFont(textFormat.first);
+        painter->setPen(textFormat.second);
+        painter->drawStaticText(QPointF(0, group->textMargin()), *staticText);
+    }
+
     if (showing) //! frame
     {
         QColor color = getHoverColor();
@@ -1382,24 +1751,30 @@ QColor Block::getHoverColor() const
 
 void Block::setShowing(bool newState, Block *until)
 {
-    if (!newState) //! switch off (recursive)
+    if (!newState) //! switch off (iterative, up to ancestors)
     {
-        level = 0;           //! reset level
+        Block *block = this;
 
-        if (this != until)
-        {
-            showing = false;    //! reset flag if this block won't be reselected again
-            if (isOverlapPossible()) updateGeometryAfter();
-        }
-        else
+        while (block != 0)
         {
-            until = parent;
-        }
+            block->level = 0;           //! reset level
 
-        repaintNeeded = true;
+            if (block != until)
+            {
+                block->showing = false;    //! reset flag if this block won't be reselected again
+                if (block->isOverlapPossible()) block->updateGeometryAfter();
+            }
+            else
+            {
+                until = block->parent;
+            }
+
+            block->repaintNeeded = true;
 
-        if (parent != 0 && (!parent->element->isSelectable() || parent->showing)) {
-            parent->setShowing(false, until);
+            if (block->parent != 0 && (!block->parent->element->isSelectable() || block->parent->showing))
+                block = block->parent;
+            else
+                block = 0;
         }
     }
     else //! switch on (iterative)
@@ -1450,7 +1825,41 @@ void Block::setGeometry(QRectF geometry)
 
 QList<Block*> Block::childBlocks() const
 {
-    return BlockGroup::blocklist_cast(childItems());
+    return orderedChildren().toList();  //! sleeping children are not child items
+}
+
+/**
+ * Returns true if I am ancestor of block. Links are followed instead of
+ * child items, sleeping blocks are not child items of their parents.
+ * Docblocks are child items of group, so I am never their ancestor.
+ */
+bool Block::isAncestorOf(const Block *block) const
+{
+    if (block == 0 || block->element == 0 || block->element->isFloating())
+        return false;
+
+    for (block = block->parent; block != 0; block = block->parent)
+    {
+        if (block == this) return true;
+    }
+
+    return false;
+}
+
+/**
+ * Returns my position in group. Positions of ancestors are summed, so it
+ * is valid also while I am out of scene (see BlockGroup::updateViewport()).
+ */
+QPointF Block::posInGroup() const
+{
+    QPointF pos = this->pos();
+
+    if (element->isFloating()) return pos;  //! docblocks are child items of group
+
+    for (const Block *block = parent; block != 0; block = block->parent)
+        pos += block->pos();
+
+    return pos;
 }
 
 QPointF Block::mapIdealToAncestor(Block* ancestor, QPointF pos) const
@@ -1479,7 +1888,10 @@ void Block::setFolded(bool fold)
     if (fold == folded) return; //! do nothing
     folded = fold;
 
-    Block *child;
+    if (foldButton == 0)    //! folded by batch before my first layout
+        foldButton = new FoldButton(this);
+
+    foldButton->setPixmap(fold ? foldButton->plus : foldButton->minus);
 
     if (fold)
     {
@@ -1490,8 +1902,9 @@ void Block::setFolded(bool fold)
             Block *block = firstChild->getFirstLeaf();
             text.append(block->element->getType());
             block = block->getNext(true);
+            int myLine = getLine();
 
-            while (block->line == line)
+            while (block->getLine() == myLine)
             {
                 QString spacesStr = QString().fill(' ',
                                                    block->getAncestorWhereFirst()->element->getSpaces());
@@ -1509,10 +1922,22 @@ void Block::setFolded(bool fold)
         }
 
         foldButton->foldText.clear();
+
+        bool selectThis = group->selectedBlock() != 0 //! selected block is descendant of this -> select this
+                && (this->isAncestorOf(group->selectedBlock())
+                    || group->selectedBlock() == this);
+
+        if (selectThis)
+            group->selectBlock(this);
+
+        releaseChildren();  //! only AST is kept while folded
         myTextItem = new TextItem(text, this, true);
+        textBlock = true;
+        keepTextItem = true;
         highlight(group->docScene->getDefaultFormat());
-        child = firstChild;
-        firstChild = 0;
+
+        if (selectThis)
+            myTextItem->setTextCursorPos(0);
     }
     else
     {
@@ -1522,24 +1947,13 @@ void Block::setFolded(bool fold)
         }
 
         myTextItem = 0;
-        firstChild = childBlocks().first();
-        child = firstChild;
-    }
-
-    while(child != 0)
-    {
-        child->setVisible(!fold);
-        child = child->nextSib;
+        textBlock = false;
+        keepTextItem = false;
+        buildTree(false);   //! recreate descendants from AST
     }
 
-    if (fold && group->selectedBlock() != 0 //! selected block is descendant of this -> select this
-        && (this->isAncestorOf(group->selectedBlock())
-            || group->selectedBlock() == this))
-    {
-        group->selectBlock(this);
-        myTextItem->setTextCursorPos(0);
-    }
-    group->mainBlock()->updateBlock(false);
+    if (!group->foldingBatch)   //! batch lays out all blocks once at the end
+        group->mainBlock()->updateBlock(false);
 }
 
 bool Block::isFoldable() const
@@ -1578,3 +1992,115 @@ void Block::updateFoldButton()
         foldButton = 0;
     }
 }
+
+/**
+ * Returns my text item, leafs which are only painted get it from group's pool first.
+ */
+TextItem *Block::textItem() const
+{
+    if (scene() == 0)
+        group->wakeBlock(const_cast<Block*>(this));  //! text item is useless out of scene
+
+    const_cast<Block*>(this)->materializeText();
+    return myTextItem;
+}
+
+/**
+ * Take text item from group's pool and show my text in it.
+ */
+void Block::materializeText()
+{
+    if (myTextItem != 0 || !textBlock) return;
+
+    myTextItem = group->takeTextItem(this, element->getType(),
+                                     element->allowsParagraphs(), element->isPaired(), keepTextItem);
+    myTextItem->setFont(textFormat.first);
+    myTextItem->setDefaultTextColor(textFormat.second);
+    myTextItem->setPos(QPointF());
+    update();   //! text item paints my text now
+}
+
+/**
+ * Return my text item to group's pool, its size is kept for layout
+ * and my text is painted by paint() again.
+ */
+void Block::releaseText()
+{
+    if (myTextItem == 0) return;
+
+    cachedTextSize = myTextItem->boundingRect().size();
+
+    if (keepTextItem)
+        delete myTextItem;
+    else
+        group->recycleTextItem(myTextItem);
+
+    myTextItem = 0;
+    update();
+}
+
+/**
+ * Drop cached text, used for leafs far from viewport.
+ */
+void Block::releaseStaticText()
+{
+    delete staticText;
+    staticText = 0;
+}
+
+/**
+ * Returns size of my text as TextItem::boundingRect() would,
+ * measured only once for blocks without text item.
+ */
+QSizeF Block::textSize() const
+{
+    if (myTextItem != 0)
+        return myTextItem->boundingRect().size();
+
+    if (!cachedTextSize.isValid())
+        cachedTextSize = group->measureText(element->getType(), textFormat.first);
+
+    return cachedTextSize;
+}
+
+int Block::textLineCount() const
+{
+    if (myTextItem != 0)
+        return myTextItem->document()->lineCount();
+
+    return element->getType().count('\n') + 1;
+}
+
+void Block::setTextFormat(QPair<QFont, QColor> format)
+{
+    if (format == textFormat && (myTextItem == 0
+            || (myTextItem->font() == format.first && myTextItem->defaultTextColor() == format.second)))
+        return;     //! style unchanged, text is not laid out again
+
+    if (format.first != textFormat.first)
+        cachedTextSize = QSizeF();  //! remeasure with new font
+
+    textFormat = format;
+
+    if (myTextItem != 0)
+    {
+        myTextItem->setFont(format.first);
+        myTextItem->setDefaultTextColor(format.second);
+    }
+    else
+    {
+        update();
+    }
+}
+
+QTimer *Block::hoverTimer()
+{
+    if (timer == 0)
+    {
+        timer = new QTimer(this);
+        timer->setSingleShot(true);
+        connect(timer, SIGNAL(timeout()), this, SLOT(acceptHover()));
+    }
+
+    return timer;
+}
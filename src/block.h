@@ -12,7 +12,6 @@
 #include <QGraphicsRectItem>
 #include <QtGui>
 #include <QList>
-#include <QPropertyAnimation>
 
 class TreeElement;
 class BlockGroup;
@@ -43,6 +42,8 @@ public:
     Block *getFirstLeaf() const;
     Block *getLastLeaf() const;
     Block *getFirstChild() const {return firstChild;}
+    Block *getLastChild() const;
+    Block *getChildInLine(int line) const;
     Block *getAncestorWhereFirst() const;
     Block *getAncestorWhereLast() const;
     Block *getNextSibling() const {return nextSib;}
@@ -50,6 +51,7 @@ public:
     Block *getNext(bool textOnly = false) const;
     Block *getPrev(bool textOnly = false) const;
     Block *getFirstSelectableAncestor() const;
+    bool isAncestorOf(const Block *block) const;
 
     bool hasMoreLines() const;
     int numberOfLines() const;
@@ -66,8 +68,7 @@ public:
     Block *parentBlock() const {return parent;}
     QList<Block*> childBlocks() const;
     BlockGroup *blockGroup() const {return group;}
-    int getLine() const {return line;}
-    void setLine(int line) {this->line = line;}
+    int getLine() const;
     virtual bool isFoldable() const;
     virtual void setFolded(bool folded);
     bool isFolded() const {return folded;}
@@ -75,8 +76,9 @@ public:
     QVariant itemChange(GraphicsItemChange change, const QVariant &value);
 
     // textItem properties
-    bool isTextBlock() const {return myTextItem != 0;}
-    TextItem *textItem() const {return myTextItem;}
+    bool isTextBlock() const {return textBlock;}
+    TextItem *textItem() const;     //! materializes text item for editing if needed
+    bool hasTextItem() const {return myTextItem != 0;}
     virtual Block *addTextCursorAt(QPointF pos);
 
     // geometry
@@ -86,6 +88,7 @@ public:
     QRectF geometry() const;
     void setGeometry(QRectF geometry);
     QRectF boundingRect() const; //! currently same as QGraphicsRectItem::rect()
+    QPointF posInGroup() const;
     QPointF mapIdealToAncestor(Block* ancestor, QPointF pos) const;    
 
     // visualization
@@ -97,10 +100,12 @@ public:
     bool isOverlapPossible() const;
     void setRepaintNeeded() {repaintNeeded = true;}
     void setYellow(bool flag) {isSearchResult = flag;}
+    bool isYellow() const {return isSearchResult;}
 
     // updaters
     virtual void updateBlock(bool doAnimation = true);
     virtual void updateGeometryAfter(bool doAnimation = true);
+    void updateAfter(bool doAnimation = true);
     void animate();
 
 public slots:
@@ -112,13 +117,33 @@ signals:
     void visibilityChanged(bool flag);
 
 protected:
+    enum InitMode { InitOnly };
+    Block(TreeElement *element, Block *parentBlock, InitMode mode);
+    void initBlock(TreeElement *element, Block *parentBlock, BlockGroup *blockGroup);
+    void buildTree(bool finishThis = true);
+    void releaseChildren();
+    void deleteDescendants();
+    void deleteFoldedElements();
+    void finishBlock();
+
+    void updateSubtree(bool doAnimation, QList<Block*> &updated);
     virtual void updatePos(bool updateReal = false);
     void updateSize(bool updateReal = false);
     void updateGeometry(bool updateReal = false);
     void updateLine();
+    void updateBottom();
     void updateFoldButton();
     QPointF getOffset(OffsetType type) const;
 
+    // text item virtualization
+    void materializeText();
+    void releaseText();
+    void releaseStaticText();
+    QSizeF textSize() const;
+    int textLineCount() const;
+    void setTextFormat(QPair<QFont, QColor> format);
+    QTimer *hoverTimer();
+
     // event processing
     void mousePressEvent(QGraphicsSceneMouseEvent *event);
     void mouseMoveEvent(QGraphicsSceneMouseEvent *event);
@@ -144,14 +169,18 @@ protected:
     bool pointed;    //! true if it is last hovered block
     bool repaintNeeded;
     bool isSearchResult;
+    bool textBlock;  //! true for AST leafs and folded blocks
+    bool keepTextItem; //! text item is never returned to pool (docblocks, folded blocks)
+    bool asleep;     //! removed from scene with my subtree by BlockGroup::updateViewport()
 
     TreeElement *element;       //! my AST element
     Block *parent;              //! my parent
     BlockGroup *group;          //! my block group
-    TextItem *myTextItem;       //! my text area (AST leafs only)
-    int line;                   //! my line
-    QPropertyAnimation *animation; //! assigned animation
+    TextItem *myTextItem;       //! my text area, only while edited (focused)
+    QStaticText *staticText;    //! cached text painted by paint() while I have no text item
+    int line;                   //! my first line, relative to parent's first line
     QRectF idealGeometry;       //! desired geometry (position + size)
+    qreal bottom;               //! max bottom of ideal geometry of me and my previous siblings
 
     Block *nextSib, *prevSib, *firstChild;    //! links
 
@@ -159,9 +188,15 @@ protected:
     QTimer *timer;              //! hover timer
 
     QPair<QFont, QColor> highlightFormat; //! format of my text (if any)
+    QPair<QFont, QColor> textFormat;      //! currently shown format of my text
+    mutable QSizeF cachedTextSize;        //! size of my text while it has no text item
 
     QPointF startDragPos; //! used to determine drag start
 
+    const QVector<Block*> &orderedChildren() const;
+    mutable QVector<Block*> children;   //! linked children in order, built on demand
+    mutable bool childrenValid;         //! false when links of children changed
+
     void removeLinks();
     void assignHighlighting(TreeElement* el);
     friend class BlockGroup;
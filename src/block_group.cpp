@@ -16,6 +16,8 @@
 #include "document_scene.h"
 #include "main_window.h"
 #include "language_manager.h"
+#include "text_buffer.h"
+#include "highlight_overlay.h"
 
 #include <QMessageBox>
 
@@ -26,6 +28,10 @@ const QString BlockGroup::BLOCK_MIME = "block_data";
 const QPointF BlockGroup::OFFSET_INSERT = QPointF(8, 0); // offset while draging
 //const QPointF BlockGroup::NO_OFFSET = QPointF(0, 0);     // default offset
 const QString GRAMMAR_DIR = "/../share/trolledit/grammars";
+const qreal VIEWPORT_MARGIN = 1.0; // screens kept materialized above and below viewport
+const int ANIMATION_DURATION = 200; // ms
+const int ANIMATION_INTERVAL = 16;  // ms between animation frames
+const int MAX_ANIMATED_BLOCKS = 500;
 
 
 BlockGroup::BlockGroup(QString text, QString file, DocumentScene *scene)
@@ -61,18 +67,29 @@ BlockGroup::BlockGroup(QString text, QString file, DocumentScene *scene)
     verticalLine->setPen(QPen(Qt::darkRed, 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
     verticalLine->setZValue(10);
     verticalLine->setVisible(false);
+    highlights = new HighlightOverlay(this);
 
     // set flags
     root = 0;
-    lineStarts.clear();
+    textStore = new TextBuffer();
+    measureDocument = new QTextDocument(this);
     lastLine = -1;
     selected = 0;
     lastXPos = -1;
     modified = true;
     searched = false;
     smoothTextAnimation = false;
+    foldingBatch = false;
+    sleepPending = true;
     foldableBlocks.clear();
 
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+    animationLimit = settings.value("maxAnimatedBlocks", MAX_ANIMATED_BLOCKS).toInt();
+    animationTimer = new QTimer(this);
+    animationTimer->setInterval(ANIMATION_INTERVAL);
+    connect(animationTimer, SIGNAL(timeout()), this, SLOT(animationTick()));
+    animationClock.start();
+
     computeTextSize();
     setAcceptDrops(true);
     setFlag(QGraphicsItem::ItemIsMovable);
@@ -91,6 +108,9 @@ BlockGroup::BlockGroup(QString text, QString file, DocumentScene *scene)
 BlockGroup::~BlockGroup()
 {
     delete txt->rc;
+    textStore->setRoot(0);  //! release leafs, blocks are deleted after me
+    delete textStore;
+    textStore = 0;
     docScene = 0;
     root = 0;
     txt = 0;
@@ -121,15 +141,17 @@ void BlockGroup::setRoot(Block *newRoot)
         root = 0;
     }
     // cleanup
-    lineStarts.clear();
     lastLine = -1;
     selected = 0;
     lastXPos = -1;
     modified = true;
     foldableBlocks.clear();
+    sceneBlocks.clear();
+    sleepPending = true;
     // set new root
     root = newRoot;
     root->setPos(20, 0);
+    textStore->setRoot(root->getElement());
     // select add cursor and update
 
     if (docScene->selectedGroup() == this)
@@ -152,6 +174,380 @@ void BlockGroup::setRoot(Block *newRoot)
     updateSize();
 }
 
+/**
+ * Returns true if item holds the text cursor (also while window is inactive).
+ */
+static bool hasTextCursor(TextItem *item)
+{
+    return item->scene() != 0 && item->scene()->focusItem() == item;
+}
+
+/**
+ * Keep only blocks near the viewport in scene. Blocks in visible area (+ margin)
+ * stay in scene, subtrees out of it are removed from scene as a whole
+ * (Block::asleep), so count of scene items depends on size of the window,
+ * not of the document. Sleeping blocks keep links, element and layout,
+ * line, fold and search logic work on them as before. Code that needs a block
+ * in scene (focus, selection) wakes it by wakeBlock(). Leafs out of area
+ * drop their cached texts and return unused text items to pool.
+ * @param sceneRect visible part of the scene
+ */
+void BlockGroup::updateViewport(QRectF sceneRect)
+{
+    if (root == 0 || !root->isVisible() || sceneRect.isEmpty()) return;
+
+    QRectF area = mapFromScene(sceneRect).boundingRect();
+    viewArea = area;
+    qreal margin = area.height() * VIEWPORT_MARGIN;
+    area.adjust(0, -margin, 0, margin);
+
+    // collect blocks in area, children are ordered by top and keep running
+    // max bottom, so first child in area is found by binary search (as in
+    // Block::findClosestChild()) and scan stops at first child below area
+    QSet<Block*> wanted;            //! leafs in area
+    QSet<Block*> visited;           //! blocks in area, they stay in scene
+    QList<Block*> candidates;       //! blocks out of area that may be in scene
+    QList<QPair<Block*, QPointF> > stack;   //! blocks to visit + position of their parent
+    stack.append(qMakePair(root, QPointF()));
+
+    foreach (QPointer<Block> block, sceneBlocks)
+    {
+        if (!block.isNull())
+            candidates.append(block);
+    }
+
+    while (!stack.isEmpty())
+    {
+        QPair<Block*, QPointF> top = stack.takeLast();
+        Block *block = top.first;
+        QRectF rect = block->idealGeometry.translated(top.second);
+
+        if (block != root && (rect.bottom() < area.top() || rect.top() > area.bottom()))
+        {
+            candidates.append(block);
+            continue;
+        }
+
+        if (block->asleep)
+        {
+            block->asleep = false;
+            block->setParentItem(block->parent);
+        }
+
+        visited.insert(block);
+
+        if (block->isTextBlock())
+        {
+            wanted.insert(block);
+            continue;
+        }
+
+        const QVector<Block*> &list = block->orderedChildren();
+        int low = 0, high = list.size();
+
+        while (low < high)
+        {
+            int mid = (low + high) / 2;
+
+            if (list.at(mid)->bottom + 1 + rect.top() > area.top())
+                high = mid;
+            else
+                low = mid + 1;
+        }
+
+        if (sleepPending)   //! new blocks may be in scene anywhere
+        {
+            for (int i = 0; i < low; i++)
+                candidates.append(list.at(i));
+        }
+
+        for (int i = low; i < list.size(); i++)
+        {
+            Block *child = list.at(i);
+
+            if (child->idealGeometry.top() + rect.top() > area.bottom())
+            {
+                for (; sleepPending && i < list.size(); i++)
+                    candidates.append(list.at(i));
+
+                break;
+            }
+
+            stack.append(qMakePair(child, rect.topLeft()));
+        }
+    }
+
+    // selected block and block with text cursor stay in scene with ancestors
+    QList<Block*> pinned;
+    QGraphicsItem *focus = docScene->focusItem();
+    Block *focused = (focus != 0) ? qgraphicsitem_cast<Block*>(focus->parentItem()) : 0;
+
+    if (selected != 0)
+        pinned << selected;
+
+    if (focused != 0 && focused->group == this)
+        pinned << focused;
+
+    foreach (Block *block, pinned)
+    {
+        wakeBlock(block);
+
+        for (; block != 0; block = block->parent)
+            visited.insert(block);
+    }
+
+    // sleep blocks out of area whose parents stay, their subtrees go with them
+    foreach (Block *block, candidates)
+    {
+        if (block->asleep || block->scene() == 0 || visited.contains(block)
+                || block->parent == 0 || !visited.contains(block->parent))
+            continue;
+
+        stopAnimation(block);
+        block->setGeometry(block->idealGeometry);
+        block->asleep = true;
+        docScene->removeItem(block);
+    }
+
+    sceneBlocks.clear();
+
+    foreach (Block *block, visited)
+        sceneBlocks.append(block);
+
+    sleepPending = false;
+
+    // release texts outside area, focused item stays with its block
+    QList<QPointer<Block> > live = textBlocks;
+    QSet<Block*> seen;
+    textBlocks.clear();
+
+    foreach (QPointer<Block> block, live)
+    {
+        if (block.isNull() || seen.contains(block)) continue;
+
+        seen.insert(block);
+
+        if (!wanted.contains(block))
+            block->releaseStaticText();
+
+        if (block->myTextItem != 0 && !hasTextCursor(block->myTextItem))
+            block->releaseText();
+
+        if (block->myTextItem != 0 || block->staticText != 0)
+            textBlocks.append(block);
+    }
+}
+
+/**
+ * Put block and its sleeping ancestors back to scene. Needed before block's
+ * text item gets focus or before block is selected.
+ */
+void BlockGroup::wakeBlock(Block *block)
+{
+    for (; block != 0; block = block->parent)
+    {
+        if (block->asleep)
+        {
+            block->asleep = false;
+            block->setParentItem(block->parent);
+        }
+
+        sceneBlocks.append(block);  //! next updateViewport() may sleep it again
+    }
+}
+
+/**
+ * Put all blocks back to scene, e.g. before whole scene is rendered.
+ * Next updateViewport() removes blocks out of area again.
+ */
+void BlockGroup::wakeAll()
+{
+    if (root == 0) return;
+
+    QList<Block*> stack;
+    stack.append(root);
+
+    while (!stack.isEmpty())
+    {
+        Block *block = stack.takeLast();
+
+        if (block->asleep)
+        {
+            block->asleep = false;
+            block->setParentItem(block->parent);
+        }
+
+        for (Block *child = block->firstChild; child != 0; child = child->nextSib)
+            stack.append(child);
+    }
+
+    sleepPending = true;
+}
+
+/**
+ * Return text items without cursor to pool, their blocks paint the text again.
+ * Called after focus change, so only the edited token keeps its item.
+ */
+void BlockGroup::releaseTextItems()
+{
+    foreach (QPointer<Block> block, textBlocks)
+    {
+        if (!block.isNull() && block->myTextItem != 0 && !hasTextCursor(block->myTextItem))
+            block->releaseText();
+    }
+}
+
+/**
+ * Start moving block from its current to its ideal geometry. Blocks moving
+ * outside of visible area are placed immediately.
+ */
+void BlockGroup::animateBlock(Block *block)
+{
+    if (block->scene() == 0)    //! sleeping or out of hierarchy, nobody sees it
+    {
+        stopAnimation(block);
+        block->setGeometry(block->idealGeometry);
+        return;
+    }
+
+    QGraphicsItem *parent = block->parentItem();
+
+    if (!viewArea.isEmpty() && parent != 0)
+    {
+        QRectF path = parent->mapRectToItem(this, block->geometry())
+                | parent->mapRectToItem(this, block->idealGeometry);
+
+        if (!path.intersects(viewArea))
+        {
+            stopAnimation(block);
+            block->setGeometry(block->idealGeometry);
+            return;
+        }
+    }
+
+    BlockAnimation animation;
+    animation.block = block;
+    animation.from = block->geometry();
+    animation.start = animationClock.elapsed();
+    animations.insert(block, animation);
+
+    if (!animationTimer->isActive())
+        animationTimer->start();
+}
+
+void BlockGroup::stopAnimation(Block *block)
+{
+    animations.remove(block);
+}
+
+/**
+ * One frame of all running animations. When too many blocks move at once
+ * (large reflow), they are placed to their ideal geometry instantly.
+ */
+void BlockGroup::animationTick()
+{
+    int now = animationClock.elapsed();
+    bool instant = animations.size() > animationLimit;
+    QMutableHashIterator<Block*, BlockAnimation> it(animations);
+
+    while (it.hasNext())
+    {
+        it.next();
+        Block *block = it.value().block;
+
+        if (block == 0)     //! block was deleted
+        {
+            it.remove();
+            continue;
+        }
+
+        QRectF from = it.value().from, to = block->idealGeometry;
+        qreal progress = instant ? 1.0 : qreal(now - it.value().start) / ANIMATION_DURATION;
+
+        if (progress >= 1.0)
+        {
+            block->setGeometry(to);
+            it.remove();
+            continue;
+        }
+
+        block->setGeometry(QRectF(from.topLeft() + (to.topLeft() - from.topLeft()) * progress,
+                                  from.size() + (to.size() - from.size()) * progress));
+    }
+
+    if (animations.isEmpty())
+        animationTimer->stop();
+}
+
+/**
+ * Remember block holding text item or cached text, so it can be released later.
+ */
+void BlockGroup::watchTextBlock(Block *block)
+{
+    textBlocks.append(block);
+}
+
+/**
+ * Returns distance of text from top of its block (margin of text item's document).
+ */
+qreal BlockGroup::textMargin() const
+{
+    return measureDocument->documentMargin();
+}
+
+/**
+ * Returns text item for given block, recycled from pool when possible.
+ * @param keep item won't be released by updateViewport()
+ */
+TextItem *BlockGroup::takeTextItem(Block *block, const QString &text, bool multiText, bool paired, bool keep)
+{
+    TextItem *item;
+
+    if (textItemPool.isEmpty())
+    {
+        item = new TextItem(text, block, multiText, paired);
+    }
+    else
+    {
+        item = textItemPool.takeLast();
+        item->setPlainText(text);   //! not connected yet, also resets undo stack
+        item->setBlock(block, multiText, paired);
+        item->setVisible(true);
+    }
+
+    if (!keep)
+        watchTextBlock(block);
+
+    return item;
+}
+
+void BlockGroup::recycleTextItem(TextItem *item)
+{
+    if (hasTextCursor(item))
+        item->clearFocus();
+
+    item->setBlock(0);
+    item->setVisible(false);
+    item->setParentItem(this);
+    textItemPool.append(item);
+}
+
+/**
+ * Returns size of TextItem::boundingRect() of item showing given text,
+ * computed without creating the item.
+ */
+QSizeF BlockGroup::measureText(const QString &text, const QFont &font)
+{
+    measureDocument->setDefaultFont(font);
+    measureDocument->setPlainText(text);
+
+    QFontMetricsF fm(font);
+    QSizeF size = measureDocument->size();
+    size.setWidth(fm.width(text) + 1);  //! see TextItem::boundingRect()
+
+    return size;
+}
+
 void BlockGroup::setModified(bool flag)
 {
     if (flag != modified)
@@ -177,73 +573,129 @@ void BlockGroup::computeTextSize()
 //    qDebug()<<"TAB_LENGTH: " << TAB_LENGTH;     //4
 }
 
+/**
+ * Returns first block (in document order) in given line. Lines are relative,
+ * so the block is found by descending from root into the child containing the line
+ * (binary search in every level, O(depth * log(children))).
+ */
 Block *BlockGroup::getBlockIn(int line) const
 {
-    if (lastLine >= line)
-        return lineStarts[line];
-    else
-        return lineStarts.last();
-}
-void BlockGroup::setBlockIn(Block *block, int line)
-{
-    if (lineStarts.size() > line)
+    Block *block = root;
+    int start = root->getLine();
+
+    while (start != line && !block->isTextBlock())
     {
-        lineStarts[line] = block;
+        Block *child = block->getChildInLine(line - start);
+
+        if (child == 0) break;
+
+        start += child->line;
+        block = child;
     }
-    else
+
+    return block;
+}
+
+TextGroup* BlockGroup::getTextGroup()
+{
+    return this->txt;
+}
+
+/**
+ * Returns foldable blocks starting in line, owner of line's fold button first.
+ * Owner is the outermost of them (the first one if there are more). Blocks
+ * are found from current lines, so result never goes stale when lines above
+ * are added or removed.
+ */
+QList<Block*> BlockGroup::foldablesIn(int line) const
+{
+    QList<Block*> blocks;
+
+    if (root == 0 || line < 0) return blocks;
+
+    Block *last = root->getLastLeaf();
+    Block *leaf = getBlockIn(line)->getFirstLeaf();
+    Block *owner = 0;
+
+    if (leaf->getLine() != line) return blocks;  //! after last line
+
+    while (true)
     {
-        while (lineStarts.size() < line)
+        // ancestors starting in the line, block starts in parent's first line if its line is 0
+        Block *top = 0;
+
+        for (Block *block = leaf; block != 0; block = block->parent)
         {
-            lineStarts << 0;
-            qWarning("Line %d skipped!", lineStarts.size() - 1);
+            if (block->isVisible() && !blocks.contains(block) && block->isFoldable())
+            {
+                blocks.append(block);
+                top = block;
+            }
+
+            if (block->line != 0) break;
         }
 
-        lineStarts << block;
+        if (top != 0 && (owner == 0 || top->isAncestorOf(owner)))
+            owner = top;
+
+        if (leaf == last) break;
+
+        leaf = leaf->getNext(true);
+
+        if (leaf->getLine() != line) break;
     }
 
-    lastLine = line;
+    if (owner != 0)
+        blocks.move(blocks.indexOf(owner), 0);
+
+    return blocks;
 }
 
-TextGroup* BlockGroup::getTextGroup()
+/**
+ * Returns owner of fold button in line, 0 if no foldable block starts there.
+ */
+Block *BlockGroup::getFoldableIn(int line) const
 {
-    return this->txt;
+    QList<Block*> blocks = foldablesIn(line);
+
+    return blocks.isEmpty() ? 0 : blocks.first();
 }
 
+/**
+ * Register block as owner of fold button in its line, only 1 per line allowed
+ * (outer block wins). Owner is resolved from current lines, button of other
+ * block in the line is hidden.
+ * @return false if block's line belongs to other block
+ */
 bool BlockGroup::addFoldable(Block *block)
 {
-    if (block->getLine() < 0) //! for block out of hierarchy (always able to fold)
+    int line = block->getLine();
+
+    if (line < 0) //! for block out of hierarchy (always able to fold)
     {
-        foldableBlocks << block;
+        foldableBlocks.insert(block);
         return true;
     }
 
-    bool able = true;
-    Block *toRemove = 0;
-    foldableBlocks.remove(block);
+    QList<Block*> blocks = foldablesIn(line);
 
-    foreach (Block *bl, foldableBlocks)
+    if (blocks.value(0, 0) != block)
     {
-        if (bl->getLine() == block->getLine())
-        {
-            if (block->isAncestorOf(bl)) {
-                toRemove = bl;                   //! if block is ancestor, throw out bl
-            }
-            else
-            {
-                able = false;
-            }
-            break;
-        }
+        foldableBlocks.remove(block);
+        return false;
     }
-    if (able)
-        foldableBlocks << block;
-    if (toRemove)
+
+    foldableBlocks.insert(block);
+
+    for (int i = 1; i < blocks.size(); i++)
     {
-        foldableBlocks.remove(toRemove);
-        toRemove->updateFoldButton();
+        Block *other = blocks.at(i);
+
+        if (foldableBlocks.remove(other) && other->foldButton != 0)
+            other->foldButton->setVisible(false);
     }
 
-    return able;
+    return true;
 }
 
 void BlockGroup::removeFoldable(Block *block)
@@ -251,6 +703,71 @@ void BlockGroup::removeFoldable(Block *block)
     foldableBlocks.remove(block);
 }
 
+/**
+ * Update fold buttons of blocks starting in line, e.g. when blocks from
+ * other lines moved into it.
+ */
+void BlockGroup::updateFoldButtons(int line)
+{
+    foreach (Block *block, foldablesIn(line))
+        block->updateFoldButton();
+}
+
+/**
+ * Fold many blocks at once, all fold states are changed first and blocks are
+ * laid out only once. With empty type, blocks nested in at least level foldable
+ * blocks (counting themselves) are folded and the others unfolded, so level 1
+ * folds all and level 0 unfolds all. With type, topmost foldable blocks of that
+ * type are folded and the rest stays as it is.
+ */
+void BlockGroup::foldBlocks(int level, QString type)
+{
+    if (root == 0) return;
+
+    time.restart();
+    foldingBatch = true;
+    int changed = 0;
+    QList<QPair<Block*, int> > stack;   //! blocks to visit + count of foldable ancestors
+    stack.append(qMakePair(root, 0));
+
+    while (!stack.isEmpty())
+    {
+        QPair<Block*, int> top = stack.takeLast();
+        Block *block = top.first;
+        int depth = top.second;
+
+        if (block != root && block->isFoldable())
+        {
+            depth++;
+            bool fold;
+
+            if (type.isEmpty())
+                fold = level > 0 && depth >= level;
+            else
+                fold = block->isFolded() || block->getElement()->getType() == type;
+
+            if (fold != block->isFolded())
+            {
+                block->setFolded(fold);     //! unfolded block has its children built again
+                changed++;
+            }
+
+            if (fold) continue;
+        }
+
+        for (Block *child = block->firstChild; child != 0; child = child->nextSib)
+            stack.append(qMakePair(child, depth));
+    }
+
+    foldingBatch = false;
+    qDebug("fold states changed: %d (%d blocks)", time.restart(), changed);
+
+    if (changed == 0) return;
+
+    root->updateBlock(false);
+    qDebug("blocks updated: %d", time.restart());
+}
+
 DocBlock *BlockGroup::addDocBlock(QPointF scenePos)
 {
     DocBlock *block = new DocBlock(mapFromScene(scenePos), this);
@@ -314,6 +831,7 @@ void BlockGroup::selectBlock(Block *block, bool updateNeeded)
     }
 
     if (selected == block) return;
+    wakeBlock(block);   //! selection is painted and followed by view
     // NOTE: only blocks that won't be selected later are deselected
     Block *commonAncestor = qgraphicsitem_cast<Block*>(block->commonAncestorItem(selected));
     deselect(commonAncestor, false);
@@ -423,7 +941,7 @@ void BlockGroup::splitLine(Block *block, int cursorPos)
     }
 
     clearSearchResults();
-    root->updateBlock();//updateAfter(true);
+    block->updateAfter(); //! new block and moved blocks follow the split one
     smoothTextAnimation = false;
 }
 
@@ -454,7 +972,7 @@ void BlockGroup::eraseChar(Block *block, int key)
                 }
 
                 target->getElement()->setLineBreaking(false);
-                root->updateBlock(); //! todo more effective updater
+                target->updateAfter();  //! only following blocks change lines
             }
             else if (target->getLine() > block->getLine()) //! jumped to the end of file
             {
@@ -489,7 +1007,7 @@ void BlockGroup::eraseChar(Block *block, int key)
                 }
 
                 target->getElement()->setLineBreaking(false);
-                root->updateBlock(); //! todo more effective updater
+                target->updateAfter();  //! only following blocks change lines
             }
             else if (target->getLine() < block->getLine()) //! jumped to the beginning of file
             {
@@ -621,7 +1139,8 @@ void BlockGroup::changeMode(QList<QAction *> actionList)
 {
     if(isVisible())
     {
-        txt->setPlainText(this->toText());
+        modeText = this->toText();
+        txt->setPlainText(modeText);
         txt->rc->setPos(this->pos());
         txt->rc->setScale(this->scale());
         txt->rc->setRect(txt->boundingRect().adjusted(-10,-10,+10,+10));
@@ -639,7 +1158,8 @@ void BlockGroup::changeMode(QList<QAction *> actionList)
     {
         txt->rc->setVisible(false);
         txt->setVisible(false);
-        this->setContent(txt->toPlainText());
+        updateFromText(txt->toPlainText());  //! only changed lines are reanalysed
+        modeText.clear();
         this->setPos(txt->rc->pos());
         this->updateSize();
         this->setVisible(true);
@@ -653,7 +1173,8 @@ void BlockGroup::changeMode(QList<QAction *> actionList)
 
 void BlockGroup::changeMode(){
     if(isVisible()){
-        txt->setPlainText(this->toText());
+        modeText = this->toText();
+        txt->setPlainText(modeText);
         txt->setPos(this->pos().x(),this->pos().y());
         txt->setScale(this->scale());
         txt->setFocus();
@@ -663,7 +1184,8 @@ void BlockGroup::changeMode(){
         docScene->update();
     }else{
         txt->setVisible(false);
-        this->setContent(txt->toPlainText());
+        updateFromText(txt->toPlainText());
+        modeText.clear();
         this->setPos(txt->pos().x(),txt->pos().y());
         this->updateSize();
         this->setVisible(true);
@@ -697,6 +1219,10 @@ void BlockGroup::updateSize()
     rect.setTopLeft(QPointF());
     rect.adjust(-20, -20, 20, 20);
     setRect(rect);
+
+    if (root != 0)
+        lastLine = root->getLine() + root->numberOfLines() - 1;
+
     docScene->update();
 }
 
@@ -720,7 +1246,7 @@ void BlockGroup::showInsertLine(InsertLine type, QPointF scenePos)
         if (line <= lastLine)
         {
             Block *block = getBlockIn(line);
-            y = mapFromItem(block, 0, 0).y();
+            y = block->posInGroup().y();
         }
         else
         {
@@ -801,7 +1327,7 @@ Block *BlockGroup::reanalyze(Block *block, QPointF cursorPos)
 //    QApplication::setOverrideCursor(Qt::CrossCursor);
     if (!reanalyzeBlock(block))
     {
-        analyzeAll(root->getElement()->getText());
+        analyzeAll(toText());
     }
 
     QApplication::restoreOverrideCursor();
@@ -823,7 +1349,7 @@ Block *BlockGroup::reanalyze(Block *block, QPointF cursorPos)
     return selected;
 }
 
-bool BlockGroup::reanalyzeBlock(Block *block)
+bool BlockGroup::reanalyzeBlock(Block *block, QString text)
 {
     qDebug("\nBlockGroup::analyzeBlock()");
     time.restart();
@@ -836,9 +1362,11 @@ bool BlockGroup::reanalyzeBlock(Block *block)
     if (analysedEl == 0) return false;
 
     // create reanalyzed element
-    TreeElement *newEl = analyzer->analyzeElement(analysedEl);
+    TreeElement *newEl = analyzer->analyzeElement(analysedEl, text);
     qDebug("text analysis: %d", time.restart());
 
+    if (newEl == 0) return false;
+
     // find block of original analyzed element
     Block *analysedBl;
     if(!TreeElement::DYNAMIC){
@@ -892,6 +1420,124 @@ bool BlockGroup::reanalyzeBlock(Block *block)
     return true;
 }
 
+/**
+ * Returns lines [from, to] joined, up to indent leading spaces are cut from each line.
+ */
+static QString joinLines(const QStringList &lines, int from, int to, int indent)
+{
+    QStringList part;
+
+    for (int i = from; i <= to; i++)
+    {
+        const QString &line = lines.at(i);
+        int cut = 0;
+
+        while (cut < indent && cut < line.length() && line.at(cut) == ' ')
+            cut++;
+
+        part << line.mid(cut);
+    }
+
+    return part.join("\n");
+}
+
+/**
+ * Bring tree in line with text edited in text mode. Lines changed since text mode
+ * started are found by common prefix and suffix of both texts, then only the smallest
+ * analysable block covering them is reanalysed with its new text. Whole text is
+ * analysed only when no such block is found.
+ * @return false if text was not changed
+ */
+bool BlockGroup::updateFromText(const QString &newText)
+{
+    if (newText == modeText) return false;
+
+    qDebug("\nBlockGroup::updateFromText()");
+    time.restart();
+    setModified(true);
+
+    if (root == 0)
+    {
+        analyzeAll(newText);
+        return true;
+    }
+
+    QStringList oldLines = modeText.split('\n');
+    QStringList newLines = newText.split('\n');
+    int oldCount = oldLines.size();
+    int delta = newLines.size() - oldCount;
+    int prefix = 0, suffix = 0;
+
+    while (prefix < oldCount && prefix < newLines.size() && oldLines.at(prefix) == newLines.at(prefix))
+        prefix++;
+
+    while (suffix < oldCount - prefix && suffix < newLines.size() - prefix
+           && oldLines.at(oldCount - 1 - suffix) == newLines.at(newLines.size() - 1 - suffix))
+        suffix++;
+
+    // changed lines of old text, inserted lines must be inside of reanalysed block
+    int first = prefix;
+    int last = oldCount - 1 - suffix;
+
+    if (last < first)
+    {
+        first = qMax(0, prefix - 1);
+        last = qMin(prefix, oldCount - 1);
+    }
+
+    qDebug("text diff: %d", time.restart());
+
+    // closest common ancestor of elements in changed lines
+    TreeElement *common = 0;
+    QSet<TreeElement*> ancestors;
+
+    for (TreeElement *el = getBlockIn(first)->getElement(); el != 0; el = el->getParent())
+        ancestors << el;
+
+    for (common = getBlockIn(last)->getElement(); common != 0 && !ancestors.contains(common); common = common->getParent());
+
+    TreeElement *unit = (common != 0) ? analyzer->getAnalysableAncestor(common) : 0;
+
+    while (unit != 0)
+    {
+        Block *unitBl = unit->getBlock();
+
+        if (unitBl != 0 && !unit->isFloating())
+        {
+            // unit must cover whole lines, its text is compared with lines it should take
+            QString unitText = unit->getText();
+            bool breaking = unitText.endsWith('\n');
+            int start = unitBl->getLine();
+            int end = start + unitText.count('\n') - (breaking ? 1 : 0);
+            int outer = 0;
+
+            for (TreeElement *el = unit->getParent(); el != 0; el = el->getParent())
+                outer += el->getSpaces();
+
+            if (start <= first && end >= last && end < oldCount && end + delta >= start
+                && joinLines(oldLines, start, end, outer) + (breaking ? "\n" : "") == unitText)
+            {
+                QString text = joinLines(newLines, start, end + delta, outer) + (breaking ? "\n" : "");
+
+                if (reanalyzeBlock(unitBl, text))
+                {
+                    qDebug("changed lines %d-%d reanalysed", first, last);
+                    return true;
+                }
+
+                break;
+            }
+        }
+
+        if (unit->getParent() == 0) break;
+
+        unit = analyzer->getAnalysableAncestor(unit->getParent());
+    }
+
+    analyzeAll(newText);
+    return true;
+}
+
 void BlockGroup::analyzeAll(QString text)
 {
     qDebug() << "text size = " << text.size();
@@ -969,7 +1615,7 @@ void BlockGroup::updateAllInThreads ()
         mutex.unlock();
         setRoot(newRoot);
         
-        qDebug("root update: %d", time.restart());
+        qDebug("root update: %d (%d lines)", time.restart(), lastLine + 1);
     }
     else {
         qDebug("groupRootEl is null");
@@ -989,16 +1635,31 @@ void BlockGroup::updateAllInMaster (TreeElement* rootEl)
     
     // set new root
     setRoot(newRoot);
-    qDebug("root update: %d", time.restart());
+    qDebug("root update: %d (%d lines)", time.restart(), lastLine + 1);
     
     qDebug("updateAllInMaster");
     return;
 }
 
 
+/**
+ * Returns text of whole group, served from the text store.
+ * Store is rebuilt only after structural changes of the tree.
+ */
 QString BlockGroup::toText(bool noDocs) const
 {
-    return root->getElement()->getText(noDocs);
+    return textStore->text(noDocs);
+}
+
+/**
+ * Returns immutable snapshot of my tree for readers in worker threads.
+ * Unchanged parts are shared with previous snapshots.
+ */
+TreeSnapshot BlockGroup::snapshot() const
+{
+    if (root == 0) return TreeSnapshot();
+
+    return TreeSnapshot(root->getElement());
 }
 
 QList<Block*> BlockGroup::blocklist_cast(QList<QGraphicsItem*> list)
@@ -1033,6 +1694,26 @@ QStatusBar *BlockGroup::getStatusBar()
 
 void BlockGroup::keyPressEvent(QKeyEvent *event)
 {
+    // move selected block among its siblings
+    if (event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier) && selected != 0
+        && (event->key() == Qt::Key_Up || event->key() == Qt::Key_Down))
+    {
+        Block *block = selected;
+        Block *nextSibling = (event->key() == Qt::Key_Up) ? block->prevSib : block->nextSib;
+
+        if (nextSibling != 0 && block->parent != 0)
+        {
+            if (event->key() == Qt::Key_Down) nextSibling = nextSibling->nextSib;
+
+            bool breaking = block->element->isLineBreaking()
+                    || (block->nextSib == 0 && block->getAncestorWhereLast()->element->isLineBreaking());
+            moveBlock(block, block->parent, nextSibling, breaking);
+        }
+
+        event->accept();
+        return;
+    }
+
     if (event->modifiers() == Qt::ControlModifier)
     {
         switch (event->key()) {
@@ -1114,6 +1795,163 @@ void BlockGroup::mousePressEvent(QGraphicsSceneMouseEvent *event)
     docScene->selectGroup(this);
 }
 
+/**
+ * Move block with its subtree before nextSibling in newParent (append if 0).
+ * Existing elements and blocks are spliced and only layout after both ends
+ * of the move is updated, earlier end first. Text around both ends is then
+ * analyzed, an end whose spliced tree differs from analysis is reanalyzed.
+ * @return false if block can't be moved there
+ */
+bool BlockGroup::moveBlock(Block *block, Block *newParent, Block *nextSibling, bool lineBreaking)
+{
+    if (block == 0 || newParent == 0 || block->group != this || newParent->group != this
+        || block == newParent || block->isAncestorOf(newParent))
+        return false;
+
+    if (nextSibling == block || (block->parent == newParent && block->nextSib == nextSibling))
+        return true; //! already there
+
+    // ancestors left without children are deleted by removeBlock(), target must not be one of them
+    Block *top = block;
+
+    while (top->parent != 0 && top->prevSib == 0 && top->nextSib == 0)
+        top = top->parent;
+
+    if (top->parent == 0 || top == newParent || top->isAncestorOf(newParent)
+        || (nextSibling != 0 && (top == nextSibling || top->isAncestorOf(nextSibling))))
+        return false;
+
+    qDebug("\nBlockGroup::moveBlock()");
+    time.restart();
+    setModified(true);
+
+    int sourceLine = block->getLine();
+    int targetLine = (nextSibling != 0) ? nextSibling->getLine()
+                                        : newParent->getLine() + newParent->numberOfLines();
+
+    // top is removed with block, layout of source is updated from its neighbour
+    Block *oldParent = top->parent;
+    Block *source = (top->nextSib != 0) ? top->nextSib : top->prevSib;
+    block->removeBlock(false);
+
+    block->element->setLineBreaking(lineBreaking);
+    block->setParentBlock(newParent, nextSibling);
+
+    if (lineBreaking && nextSibling == 0 && block->prevSib != 0)
+        block->prevSib->element->setLineBreaking(true);
+
+    qDebug("subtree spliced: %d", time.restart());
+    clearSearchResults();   //! marks and highlighted lines are not valid after move
+
+    if (source == 0) source = oldParent;
+
+    if (source == oldParent && oldParent->firstChild == 0)
+    {
+        root->updateBlock();
+    }
+    else if (targetLine <= sourceLine)
+    {
+        block->updateAfter();
+        source->updateAfter();
+    }
+    else
+    {
+        source->updateAfter();
+        block->updateAfter();
+    }
+
+    qDebug("layout updated: %d", time.restart());
+
+#ifndef QT_NO_DEBUG
+    // old parent must have shrunk to its remaining children
+    QRectF children;
+
+    for (Block *child = oldParent->firstChild; child != 0; child = child->nextSib)
+        children |= child->idealGeometry;
+
+    Q_ASSERT(oldParent->isTextBlock() || oldParent->idealSize() == children.size());
+#endif
+
+    // splice is kept only where analyzer builds the same tree from the text
+    QPointer<Block> moved = block;
+    QPointer<Block> left = source;
+    QPointer<Block> lostParent = oldParent;
+    TreeElement *targetEl = analyzer->getAnalysableAncestor(block->getElement());
+
+    if (!matchesAnalysis(targetEl))
+        reanalyzeEnd(block, newParent);
+
+    if (!left.isNull() && inTree(left))
+    {
+        TreeElement *sourceEl = analyzer->getAnalysableAncestor(left->getElement());
+
+        if (sourceEl != targetEl && !matchesAnalysis(sourceEl))
+            reanalyzeEnd(left, (!lostParent.isNull() && inTree(lostParent)) ? lostParent : 0);
+    }
+
+    qDebug("ends analyzed: %d", time.restart());
+
+    if (!moved.isNull() && inTree(moved))
+        selectBlock(moved, true);
+
+    docScene->update();
+
+    return true;
+}
+
+/**
+ * Returns true if block is root or linked under it (not removed or replaced).
+ */
+bool BlockGroup::inTree(Block *block) const
+{
+    return block != 0 && root != 0 && (block == root || root->isAncestorOf(block));
+}
+
+/**
+ * Analyze text of element (whole document if 0) and compare result with
+ * current tree.
+ * @return false if analyzer rejects the text or builds different tree
+ */
+bool BlockGroup::matchesAnalysis(TreeElement *analysedEl)
+{
+    TreeElement *parsed;
+
+    if (analysedEl != 0)
+    {
+        parsed = analyzer->analyzeElement(analysedEl);
+    }
+    else
+    {
+        analysedEl = root->getElement()->getRoot();
+        parsed = analyzer->analyzeFull(toText());
+    }
+
+    if (parsed == 0) return false;
+
+    bool same = parsed->childCount() == analysedEl->childCount();
+
+    for (int i = 0; same && i < analysedEl->childCount(); i++)
+        same = analysedEl->child(i)->sameTree(parsed->child(i));
+
+    parsed->deleteAllChildren();
+    delete parsed;
+
+    return same;
+}
+
+/**
+ * Reanalyze one end of a move. If analyzer rejects the text around block,
+ * its parent is reanalyzed, and whole document if analyzer rejects that too.
+ */
+void BlockGroup::reanalyzeEnd(Block *block, Block *parent)
+{
+    if (reanalyzeBlock(block)) return;
+
+    if (parent != 0 && reanalyzeBlock(parent)) return;
+
+    analyzeAll(toText());
+}
+
 void BlockGroup::dropEvent(QGraphicsSceneDragDropEvent *event) // todo refactor
 {
     if (event->mimeData()->hasFormat(BLOCK_MIME))
@@ -1161,6 +1999,22 @@ void BlockGroup::dropEvent(QGraphicsSceneDragDropEvent *event) // todo refactor
             return;
         }
 
+        Block *newParent = target->parent;
+        Block *nextSibling;
+
+        if (shiftMod)
+            nextSibling = isRight ? target : target->nextSib;
+        else
+            nextSibling = lineNo <= lastLine ? target : 0;
+
+        // move inside group splices existing subtree, copies and other groups go through text
+        if (event->dropAction() != Qt::CopyAction && selected->blockGroup() == this
+            && moveBlock(selected, newParent, nextSibling, !shiftMod))
+        {
+            event->accept();
+            return;
+        }
+
         setModified(true);
 
         // clone block
@@ -1180,14 +2034,12 @@ void BlockGroup::dropEvent(QGraphicsSceneDragDropEvent *event) // todo refactor
         if (shiftMod)
         {
             clone->element->setLineBreaking(false);
-            Block* nextSibling = isRight ? target : target->nextSib;
-            clone->setParentBlock(target->parent, nextSibling);
+            clone->setParentBlock(newParent, nextSibling);
         }
         else
         {
             clone->element->setLineBreaking(true);
-            Block* nextSibling = lineNo <= lastLine ? target : 0;
-            clone->setParentBlock(target->parent, nextSibling);
+            clone->setParentBlock(newParent, nextSibling);
 
             if (nextSibling == 0) clone->prevSib->getElement()->setLineBreaking(true);
         }
@@ -1197,11 +2049,17 @@ void BlockGroup::dropEvent(QGraphicsSceneDragDropEvent *event) // todo refactor
         {
             selected->setVisible(false);
             BlockGroup *sourceGroup = selected->blockGroup();
-            selected->removeBlock(true);
+            Block *next = selected->removeBlock(true);
 
             if (sourceGroup != this)
             {
-                sourceGroup->root->updateBlock();
+                // only blocks after removed one change in source
+                sourceGroup->clearSearchResults();
+
+                if (next != 0)
+                    next->updateAfter();
+                else
+                    sourceGroup->root->updateBlock();
             }
         }
         // reanalyze all
@@ -1305,38 +2163,34 @@ void BlockGroup::highlightLines(QSet<int> lines)
     if(highlight){
     if (lines.isEmpty()) return;
 
-//    foreach (QGraphicsRectItem *hRect, highlightingRects.values()) {
-//        int key = highlightingRects.key(hRect);
-//        if (!lines.contains(key)) {
-//            highlightingRects.remove(key);
-//            delete hRect;
-//        }
-//    }
-
     qreal offset = 4;
-    QColor color;
-    color.setNamedColor("yellow");
-    color.setAlpha(100);
+    QList<int> sorted = lines.toList();
+    qSort(sorted);
+
+    // all lines are passed to overlay at once, it has no item per line
+    QVector<int> newLines;
+    QVector<QRectF> newRects;
 
-    foreach (int line, lines)
+    foreach (int line, sorted)
     {
-        if (highlightingRects.value(line, 0) != 0) continue;
+        if (highlights->hasLine(line)) continue;
 
         Block *bl = getBlockIn(line);
 
         if (bl != 0)
         {
-            QPointF pos = mapFromItem(bl, 0, 0);
-            QGraphicsRectItem *hRect = new QGraphicsRectItem(
-                    pos.x(), pos.y() + offset,
-                    root->idealSize().width() - pos.x(), CHAR_HEIGHT - 2*offset,
-                    this);
-            hRect->setPen(QPen(color));
-            hRect->setBrush(QBrush(color));
-            highlightingRects.insert(line, hRect);
-            searched = true;
+            QPointF pos = bl->posInGroup();     //! also for blocks out of scene
+            newLines << line;
+            newRects << QRectF(pos.x(), pos.y() + offset,
+                               root->idealSize().width() - pos.x(), CHAR_HEIGHT - 2*offset);
         }
     }
+
+    if (!newLines.isEmpty())
+    {
+        highlights->addLines(newLines, newRects);
+        searched = true;
+    }
     }else{
 
     }
@@ -1347,66 +2201,168 @@ bool BlockGroup::searchBlocks(QString searchStr, bool allowInner, bool exactMatc
     if (searchStr.isEmpty()) return false;
 
     bool found = false;
-    TreeElement *el = root->getElement();
-    Block *bl;
 
     if (allowInner) searchStr.replace(" ", "_");
 
-    while (el->hasNext())
+    // candidates come from index of text store, tree is not walked
+    foreach (TreeElement *foundEl, textStore->find(searchStr, allowInner, exactMatch))
     {
-        if (allowInner || el->isLeaf())
+        Block *bl;
+
+        do
         {
-            if ((!exactMatch && el->getType().contains(searchStr)) ||
-                el->getType() == searchStr)
-            {
-                TreeElement *foundEl = el;
-                do
-                {
-                    bl = foundEl->getBlock();
+            bl = foundEl->getBlock();
 
-                    if (foundEl->isLeaf()) break;
+            if (foundEl->isLeaf()) break;
 
-                    foundEl = (*foundEl)[0];
-                }
-                while (bl == 0);
+            foundEl = (*foundEl)[0];
+        }
+        while (bl == 0);
 
-                if (bl != 0)
-                {
-                    bl->setYellow(true);
-                    found = true;
-                }
-            }
+        if (bl == 0) continue;
+
+        if (!bl->isYellow()) //! mark flag keeps searchResults a set
+        {
+            bl->setYellow(true);
+            searchResults << bl;
         }
-        el = el->next();
+
+        found = true;
     }
+
     if (found) searched = true;
 
     return found;
 }
 
-void BlockGroup::clearSearchResults()
+/**
+ * Returns true if c can be part of identifier.
+ */
+static bool isWordChar(QChar c)
 {
-    if (!searched) return;
+    return c.isLetterOrNumber() || c == '_';
+}
 
-    searched = false;
+/**
+ * Replace occurrences of findStr in text. With wholeWords an occurrence is
+ * replaced only if it is not part of longer word (identifier "i" is not
+ * replaced in "if", "int" or "min").
+ * @return count of replaced occurrences
+ */
+static int replaceInLeaf(QString &text, const QString &findStr, const QString &replaceStr,
+                         bool wholeWords)
+{
+    bool wordStart = isWordChar(findStr.at(0));
+    bool wordEnd = isWordChar(findStr.at(findStr.length() - 1));
+    int count = 0;
+    int pos = text.indexOf(findStr);
 
-    TreeElement *el = root->getElement();
-    Block *bl;
+    while (pos >= 0)
+    {
+        int end = pos + findStr.length();
+
+        if (wholeWords && ((wordStart && pos > 0 && isWordChar(text.at(pos - 1)))
+                           || (wordEnd && end < text.length() && isWordChar(text.at(end)))))
+        {
+            pos = text.indexOf(findStr, pos + 1);
+            continue;
+        }
+
+        text.replace(pos, findStr.length(), replaceStr);
+        count++;
+        pos = text.indexOf(findStr, pos + replaceStr.length());
+    }
 
-    while (el->hasNext())
+    return count;
+}
+
+/**
+ * Replace text in leafs of scope (whole tree if 0), with nodeType only in leafs
+ * inside nodes of that type. Comments are skipped. With wholeWords only whole
+ * words are replaced. All leafs are changed first (piece table is patched),
+ * then their closest common ancestor is reanalysed once.
+ * @return count of changed leafs
+ */
+int BlockGroup::replaceAll(QString findStr, QString replaceStr, Block *scope, QString nodeType,
+                           bool wholeWords)
+{
+    if (root == 0 || findStr.isEmpty()) return 0;
+
+    time.restart();
+    TreeElement *scopeEl = (scope != 0) ? scope->getElement() : 0;
+    QList<TreeElement*> changed;
+    QStringList newTexts;
+
+    foreach (TreeElement *el, textStore->find(findStr, false, false))
     {
-        bl = el->getBlock();
+        if (analyzer->isComment(el)) continue;
+
+        if (el->getType().contains('\n')) continue;  //! multiline leafs are multiline comments or strings
+
+        if (scopeEl != 0 && el != scopeEl && !scopeEl->isAncestorOf(el)) continue;
+
+        if (!nodeType.isEmpty())
+        {
+            TreeElement *ancestor = el->getParent();
+
+            while (ancestor != 0 && ancestor->getType() != nodeType)
+                ancestor = ancestor->getParent();
+
+            if (ancestor == 0) continue;
+        }
 
-        if (bl != 0) bl->setYellow(false);
+        QString text = el->getType();
 
-        el = el->next();
+        if (replaceInLeaf(text, findStr, replaceStr, wholeWords) == 0) continue;
+
+        changed << el;
+        newTexts << text;
     }
 
-    foreach (QGraphicsRectItem *hRect, highlightingRects.values())
+    if (changed.isEmpty()) return 0;
+
+    // change leafs, find their closest common ancestor
+    TreeElement *common = changed.first();
+
+    for (int i = 0; i < changed.size(); i++)
     {
-        delete hRect;
+        TreeElement *el = changed.at(i);
+        el->setType(newTexts.at(i));
+
+        while (common != el && !common->isAncestorOf(el))
+            common = common->getParent();
+    }
+
+    qDebug("leafs replaced: %d (%d leafs)", time.restart(), changed.size());
+
+    while (common->getBlock() == 0 && common->getParent() != 0)  //! unimportant or folded
+        common = common->getParent();
+
+    Block *block = common->getBlock();   //! 0 - whole text is analysed
+    setModified(true);
+    reanalyze(block, block != 0 ? mapToScene(block->posInGroup()) : QPointF());
+
+    return changed.size();
+}
+
+/**
+ * Unmark blocks of last search, called on most keystrokes. Only blocks in
+ * searchResults are touched, without search results it returns at once.
+ */
+void BlockGroup::clearSearchResults()
+{
+    if (!searched) return;
+
+    searched = false;
+
+    foreach (QPointer<Block> bl, searchResults)
+    {
+        if (bl.isNull()) continue;
+
+        bl->setYellow(false);
+        bl->update();
     }
 
-    highlightingRects.clear();
-    qDebug("Search cleared");
+    searchResults.clear();
+    highlights->clear();
 }
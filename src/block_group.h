@@ -19,14 +19,19 @@
 #include <QThreadPool>
 #include <QMessageBox>
 #include <QMutex>
+#include <QPointer>
 
 #include "analyzer.h"
 #include "text_group.h"
+#include "tree_snapshot.h"
 
 class Block;
 class DocBlock;
 class DocumentScene;
 class FoldButton;
+class HighlightOverlay;
+class TextBuffer;
+class TextItem;
 
 class BlockGroup : public QObject, public QGraphicsRectItem
 {
@@ -58,9 +63,13 @@ public:
 
     // block management
     Block *getBlockIn(int line) const;
-    void setBlockIn(Block *block, int line);
+    Block *getFoldableIn(int line) const;
     bool addFoldable(Block *block);
     void removeFoldable(Block *block);
+    void updateFoldButtons(int line);
+    bool moveBlock(Block *block, Block *newParent, Block *nextSibling, bool lineBreaking);
+    void foldBlocks(int level, QString type = QString());
+    bool foldingBatch;          //! true while batch folding, blocks are laid out after it
 
     void selectBlock(Block *block, bool updateNeeded = false);
     void deselect(Block *until = 0, bool updateNeeded = false);
@@ -75,6 +84,8 @@ public:
     void highlightLines(QSet<int> lines);
     void highlightON_OFF();
     bool searchBlocks(QString searchStr, bool allowInner, bool exactMatch);
+    int replaceAll(QString findStr, QString replaceStr, Block *scope = 0, QString nodeType = QString(),
+                   bool wholeWords = true);
     void clearSearchResults();
 
     // analysis
@@ -82,9 +93,27 @@ public:
     Analyzer *getAnalyzer() const {return analyzer;}
     Block *reanalyze(Block* block = 0, QPointF cursorPos = QPointF());
     void analyzeAll(QString text);
-    bool reanalyzeBlock(Block* block);
+    bool reanalyzeBlock(Block* block, QString text = QString());
+    bool updateFromText(const QString &newText);
     QString toText(bool noDocs = false) const;
-    
+    TreeSnapshot snapshot() const;
+
+    // virtualization, blocks far from viewport are out of scene, leafs there have no text
+    void updateViewport(QRectF sceneRect);
+    void wakeBlock(Block *block);
+    void wakeAll();
+    bool sleepPending;          //! blocks were built, next updateViewport() checks all children
+    TextItem *takeTextItem(Block *block, const QString &text, bool multiText, bool paired, bool keep);
+    void recycleTextItem(TextItem *item);
+    void watchTextBlock(Block *block);
+    QSizeF measureText(const QString &text, const QFont &font);
+    qreal textMargin() const;
+
+    // animation
+    void animateBlock(Block *block);
+    void stopAnimation(Block *block);
+    int animationLimit;         //! above this count of moving blocks layout is applied instantly
+
     // paralelism
     QFutureWatcher<TreeElement*> watcher;
     QFuture<TreeElement*> future;
@@ -125,6 +154,8 @@ public slots:
     void eraseChar(Block *block, int key);
     void moveFrom(Block *block, int key, int cursorPos);
     void updateSize();
+    void releaseTextItems();
+    void animationTick();
     TreeElement* analazyAllInThread (QString text);
     void updateAllInThreads ();
 
@@ -142,23 +173,45 @@ private:
     void setRoot(Block *newRoot);
     void moveCursorUpDown(Block *start, bool moveUp, int from);
     void moveCursorLeftRight(Block *start, bool moveRight);
+    bool inTree(Block *block) const;
+    QList<Block*> foldablesIn(int line) const;
+    bool matchesAnalysis(TreeElement *analysedEl);
+    void reanalyzeEnd(Block *block, Block *parent);
 
     void computeTextSize();
 
     // fields
     TextGroup *txt;
+    TextBuffer *textStore;      //! piece table with text of my tree
+    QString modeText;           //! text shown when text mode started, diffed on return
     QString fileName;           //! name of currently loaded file
     Analyzer *analyzer;         //! my analyzer
     Block *root;                //! main (root) block
     Block *selected;            //! currently selected block
-    QList<Block*> lineStarts;   //! line starting blocks
     int lastLine;               //! curent last line
-    QSet<Block*> foldableBlocks;//! foldable blocks, only 1 per line allowed
+    QSet<Block*> foldableBlocks;        //! blocks showing fold button, only 1 per line allowed
     qreal lastXPos;
     QGraphicsLineItem *horizontalLine, *verticalLine; //! insertion cues
     bool modified;
-    QHash<int, QGraphicsRectItem*> highlightingRects;
+    HighlightOverlay *highlights;       //! highlighted lines of search results
     bool searched;
+    QList<QPointer<Block> > searchResults;  //! blocks marked by last search
+    QList<QPointer<Block> > textBlocks; //! blocks holding text item or cached text
+    QList<QPointer<Block> > sceneBlocks; //! blocks in scene after last updateViewport() or woken since
+    QList<TextItem*> textItemPool;      //! released text items ready for reuse
+    QTextDocument *measureDocument;     //! measures text of blocks without text item
+    QRectF viewArea;                    //! visible part of me, without margin
+
+    struct BlockAnimation
+    {
+        QPointer<Block> block;
+        QRectF from;        //! geometry when animation started
+        int start;          //! start time on animation clock
+    };
+
+    QHash<Block*, BlockAnimation> animations; //! blocks moving to their ideal geometry
+    QTimer *animationTimer;     //! drives all animations of my blocks
+    QTime animationClock;
 
     friend class DocumentScene;
 };
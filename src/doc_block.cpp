@@ -19,6 +19,8 @@
 DocBlock::DocBlock(QPointF pos, BlockGroup *parentgroup)    //! manual creation
     : Block(new TreeElement("doc_comment", true, true), 0, parentgroup)
 {    
+    keepTextItem = true;    //! docblock always shows its content
+    materializeText();
     element->setFloating(true);
 
     // find arrow target
@@ -55,6 +57,8 @@ DocBlock::DocBlock(QString text, TreeElement* el, Block* parentBlock, BlockGroup
     : Block(el, parentBlock, parentgroup)
 {
     Q_ASSERT(el->isFloating()); //! automatic creation should be called for floating elements only
+    keepTextItem = true;    //! docblock always shows its content
+    materializeText();
     // find arrow target
     Block *arrowTarget = 0;
 
@@ -117,6 +121,7 @@ void DocBlock::updateBlockInMap(DocBlock* element)
 
 void DocBlock::updateBlock(bool doAnimation)
 {
+    element->docTextChanged(convertToText());  //! patch my piece only if my text changed
     // update line
     line = -1;
     // update pos
@@ -150,7 +155,7 @@ void DocBlock::updatePos(bool updateReal)
         }
         else
         {
-            setPos(group->mapFromItem(target, target->idealRect().topRight()) + QPointF(100, 0));
+            setPos(target->posInGroup() + target->idealRect().topRight() + QPointF(100, 0));
         }
     }
 
@@ -456,6 +461,7 @@ void DocBlock::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
     QGraphicsRectItem::mouseMoveEvent(event);
     locked = true;
+    element->docTextChanged(convertToText());  //! position is saved with text
     group->updateSize();
 }
 
@@ -17,16 +17,30 @@
 #include "doc_block.h"
 #include "tree_element.h"
 #include "language_manager.h"
+#include "text_search.h"
+#include "file_saver.h"
 #include <QtGui>
 
 QTime DocumentScene::time;
 int unknownCounter = 0;
+const int SEARCH_DELAY = 150;  // ms of typing pause before search starts
 
 DocumentScene::DocumentScene(MainWindow *parent)
     : QGraphicsScene(parent)
 {
     window = parent;    // currently not in use
     currentGroup = 0;
+    textSearch = new TextSearch(this);
+    connect(textSearch, SIGNAL(finished(bool)), this, SLOT(textSearchFinished(bool)));
+    searchTimer = new QTimer(this);
+    searchTimer->setSingleShot(true);
+    searchTimer->setInterval(SEARCH_DELAY);
+    connect(searchTimer, SIGNAL(timeout()), this, SLOT(runPendingSearch()));
+    blockSearchExact = false;
+    saver = new FileSaver(this);
+    connect(saver, SIGNAL(progress(QString,int)), this, SLOT(saveProgress(QString,int)));
+    connect(saver, SIGNAL(saved(BlockGroup*,QString)), this, SLOT(groupSaved(BlockGroup*,QString)));
+    connect(saver, SIGNAL(failed(BlockGroup*,QString,QString)), this, SLOT(saveFailed(BlockGroup*,QString,QString)));
 //    setItemIndexMethod(QGraphicsScene::NoIndex);
 }
 
@@ -139,9 +153,9 @@ void DocumentScene::revertGroup(BlockGroup *group)
 
 void DocumentScene::saveGroup(QString fileName, BlockGroup *group, bool noDocs)
 {
-    group=getBlockGroup();
+    if (group == 0) group = getBlockGroup();
 
-    QFile file;
+    if (group == 0) return;
 
     if (fileName.isEmpty())
     {
@@ -153,38 +167,52 @@ void DocumentScene::saveGroup(QString fileName, BlockGroup *group, bool noDocs)
         }
         else
         {
-            file.setFileName(group->getFilePath());
+            fileName = group->getFilePath();
         }
     }
-    else
-    {
-        file.setFileName(fileName);
-    }
-
-    if (!file.open(QIODevice::WriteOnly))
-    {
-        QMessageBox::warning(new QWidget, tr("TrollEdit"),
-                             tr("Cannot write file %1:\n%2.").arg(file.fileName()).arg(file.errorString()));
-        return;
-    }
 
-    QApplication::setOverrideCursor(Qt::WaitCursor);
-    QTextStream out(&file);
-    out << group->toText(noDocs);
-    QApplication::restoreOverrideCursor();
+    // only text is taken here, it is encoded and written on thread pool
+    saver->save(group, fileName, group->toText(noDocs));
 
-    group->setFileName(file.fileName());
-    group->setModified(false);
+    group->setFileName(fileName);
+    group->setModified(false);  //! edits made while saving mark group modified again
     update();
     emit modified(false);
 
-    QString msg = "File saved";
+    QString msg = "Saving file";
 
     if (noDocs) msg.append(" without comments");
 
     window->statusBar()->showMessage(msg, 2000);
 }
 
+void DocumentScene::saveProgress(QString fileName, int percent)
+{
+    window->statusBar()->showMessage(tr("Saving %1... %2%").arg(QFileInfo(fileName).fileName()).arg(percent));
+}
+
+void DocumentScene::groupSaved(BlockGroup *group, QString fileName)
+{
+    Q_UNUSED(group);
+
+    window->statusBar()->showMessage(tr("File %1 saved").arg(QFileInfo(fileName).fileName()), 2000);
+}
+
+void DocumentScene::saveFailed(BlockGroup *group, QString fileName, QString error)
+{
+    window->statusBar()->clearMessage();
+
+    if (group != 0 && groups.contains(group))
+    {
+        group->setModified(true);
+
+        if (group == currentGroup) emit modified(true);
+    }
+
+    QMessageBox::warning(window, tr("TrollEdit"),
+                         tr("Cannot write file %1:\n%2.").arg(fileName).arg(error));
+}
+
 void DocumentScene::saveGroupAs(BlockGroup *group)
 {
     //group=getBlockGroup();
@@ -270,15 +298,57 @@ void DocumentScene::closeAllGroups()
     }
 }
 
-void DocumentScene::findText(QString searchStr, BlockGroup *group)
+/**
+ * Search as you type: query is searched when typing pauses for SEARCH_DELAY,
+ * erased query clears results at once.
+ */
+void DocumentScene::findTextLater(QString searchStr)
 {
-    if (searchStr.isEmpty()) return;
+    pendingSearch = searchStr;
+
+    if (searchStr.isEmpty())
+    {
+        searchTimer->stop();
+        findText(searchStr);
+        return;
+    }
 
+    searchTimer->start();
+}
+
+void DocumentScene::runPendingSearch()
+{
+    findText(pendingSearch);
+}
+
+/**
+ * Text is scanned on thread pool first, blocks are searched only when it finishes
+ * with a match, so GUI thread does no work for queries which are not in text.
+ * Inner blocks (@type) are not in text, they are searched at once.
+ */
+void DocumentScene::findText(QString searchStr, BlockGroup *group)
+{
     group=getBlockGroup();
+    blockSearchStr.clear();
+
+    if (searchStr.isEmpty()) //! query erased while typing
+    {
+        textSearch->cancel();
+
+        if (group != 0)
+        {
+            group->clearSearchResults();
+            group->update();
+        }
+        return;
+    }
 
-    bool ret = false;
+    if (group == 0) return;
+
+    textSearch->cancel();   //! query changed, drop running text search
     group->clearSearchResults();
     bool inner = false;
+    bool exact = false;
 
     QRegExp blockMatch("@(\\S*)");
 
@@ -292,42 +362,35 @@ void DocumentScene::findText(QString searchStr, BlockGroup *group)
     if (exactMatch.indexIn(searchStr) > -1) //! only exact blocks
     {
         searchStr = exactMatch.cap(1);
-        ret = group->searchBlocks(searchStr, inner, true);
-    }
-    else //! any blocks
-    {
-        ret = group->searchBlocks(searchStr, inner, false);
+        exact = true;
     }
 
-    if (!ret && !inner) //! search text
+    if (inner)
     {
-        QSet<int> lineNumbers;
-        QString allText = group->toText(true);
-        QStringList lines = allText.split("\n", QString::KeepEmptyParts);
-
-        for (int i =0 ;i < lines.size(); i++)
+        if (group->searchBlocks(searchStr, true, exact))
         {
-            QString line = lines.at(i);
-
-            if (line.contains(searchStr)) lineNumbers << i;
-
+            group->update();
+            window->statusBar()->showMessage("Search finished", 1000);
         }
-
-        if (!lineNumbers.isEmpty())
+        else
         {
-            group->highlightLines(lineNumbers);
-            ret = true;
+            window->statusBar()->showMessage("Not found", 1000);
         }
+        return;
     }
-    if (ret)
-    {
-        group->update();
-        window->statusBar()->showMessage("Search finished", 1000);
-    }
-    else
+
+    QString pattern = searchStr;
+
+    if (!TextSearch::parsePattern(pattern)) //! regular expressions match lines only
     {
-        window->statusBar()->showMessage("Not found", 1000);
+        blockSearchGroup = group;
+        blockSearchStr = searchStr;
+        blockSearchExact = exact;
     }
+
+    // search text on thread pool, lines are highlighted as they are found
+    textSearch->start(group, group->toText(true), searchStr);
+    window->statusBar()->showMessage("Searching...");
 }
 
 void DocumentScene::cleanGroup(BlockGroup *group)
@@ -510,17 +573,15 @@ void DocumentScene::mousePressEvent(QGraphicsSceneMouseEvent *event)
             for (int i = 0; i <= currentGroup->lastLine; i++)
             {
                 str.append(QString("%1").arg(i)).
-                        append(" - "+currentGroup->lineStarts[i]->getElement()->getType()+": ").
-                        append(currentGroup->lineStarts[i]->getFirstLeaf()->getElement()->getType()+"\n");
+                        append(" - "+currentGroup->getBlockIn(i)->getElement()->getType()+": ").
+                        append(currentGroup->getBlockIn(i)->getFirstLeaf()->getElement()->getType()+"\n");
             }
 
             str.append(QString("Last line: %1").arg(currentGroup->lastLine));
 
         }
         else if ((event->modifiers() & Qt::AltModifier) == Qt::AltModifier){
-            QList<TreeElement*> list = rootEl->getDescendants();
-
-            foreach (TreeElement *el, list)
+            for (TreeElement *el = rootEl->nextDescendant(rootEl); el != 0; el = el->nextDescendant(rootEl))
             {
                 str.append("- ");
 
@@ -538,9 +599,7 @@ void DocumentScene::mousePressEvent(QGraphicsSceneMouseEvent *event)
         }
         else if ((event->modifiers() & Qt::ShiftModifier) == Qt::ShiftModifier)
         {
-            QList<TreeElement*> list = rootEl->getDescendants();
-
-            foreach (TreeElement *el, list)
+            for (TreeElement *el = rootEl->nextDescendant(rootEl); el != 0; el = el->nextDescendant(rootEl))
             {
                 if (el->getBlock() != 0)
                 {
@@ -663,9 +722,27 @@ void DocumentScene::mouseDoubleClickEvent(QGraphicsSceneMouseEvent *event)
 void DocumentScene::update(const QRectF &rect)
 {
     adjustSceneRect();//QRectF(views().first()->rect()));
+    updateViewport();
     QGraphicsScene::update(rect);
 }
 
+/**
+ * Let groups remove blocks and texts outside the visible part of the scene,
+ * called when view is scrolled and after layout changes.
+ */
+void DocumentScene::updateViewport()
+{
+    if (views().isEmpty()) return;
+
+    QGraphicsView *view = views().first();
+    QRectF visible = view->mapToScene(view->viewport()->rect()).boundingRect();
+
+    foreach (BlockGroup *group, groups)
+    {
+        group->updateViewport(visible);
+    }
+}
+
 void DocumentScene::adjustSceneRect()
 {
     QRectF rect = views().first()->rect();
@@ -714,6 +791,61 @@ void DocumentScene::setHighlighting(const QList<QPair<QString, QHash<QString, QS
 
         highlighting.insert(configData.value(i).first, QPair<QFont, QColor>(font, color));
     }
+
+    compileStyles();
+}
+
+/**
+ * Build style table from config styles, so blocks find their highlighting with
+ * one lookup instead of string tests (hardcoded "funct_" rules are resolved here).
+ */
+void DocumentScene::compileStyles()
+{
+    styles.clear();
+    nodeStyles.clear();
+    defaultStyle = highlighting.value("text_style");
+
+    QHashIterator<QString, QPair<QFont, QColor> > it(highlighting);
+
+    while (it.hasNext())
+    {
+        it.next();
+        NodeStyle nodeStyle;
+        nodeStyle.style = styles.size();
+
+        if (it.key() == "funct_call")
+            nodeStyle.role = NodeStyle::FunctCall;
+        else if (it.key() == "funct_definition")
+            nodeStyle.role = NodeStyle::FunctDefinition;
+        else if (it.key().startsWith("funct_"))
+            nodeStyle.role = NodeStyle::None;
+        else
+            nodeStyle.role = NodeStyle::Leafs;
+
+        styles.append(it.value());
+        nodeStyles.insert(it.key(), nodeStyle);
+    }
+}
+
+/**
+ * Returns compiled style of node type, 0 if type has no style.
+ */
+const NodeStyle *DocumentScene::nodeStyle(const QString &type) const
+{
+    QHash<QString, NodeStyle>::const_iterator it = nodeStyles.constFind(type);
+
+    return it != nodeStyles.constEnd() ? &it.value() : 0;
+}
+
+void DocumentScene::textSearchFinished(bool found)
+{
+    // query is in text, mark blocks containing it too
+    if (found && !blockSearchStr.isEmpty() && !blockSearchGroup.isNull()
+            && blockSearchGroup->searchBlocks(blockSearchStr, false, blockSearchExact))
+        blockSearchGroup->update();
+
+    blockSearchStr.clear();
+    window->statusBar()->showMessage(found ? "Search finished" : "Not found", 1000);
 }
 
 bool DocumentScene::hasFormatFor(QString key) const
@@ -726,11 +858,6 @@ QPair<QFont, QColor> DocumentScene::getFormatFor(QString key) const
     return highlighting.value(key);
 }
 
-QPair<QFont, QColor> DocumentScene::getDefaultFormat() const
-{
-    return highlighting.value("text_style");
-}
-
 void DocumentScene::dragEnterEvent(QGraphicsSceneDragDropEvent *event)
 {
     focusInEvent(new QFocusEvent(QEvent::FocusIn, Qt::MouseFocusReason));
@@ -11,10 +11,34 @@
 #include <QHash>
 #include <QString>
 #include <QUrl>
+#include <QVector>
+#include <QFont>
+#include <QColor>
+#include <QPointer>
 
 class Analyzer;
 class BlockGroup;
 class MainWindow;
+class TextSearch;
+class FileSaver;
+class QTimer;
+
+/**
+ * Highlighting of one node type, compiled once from config styles.
+ */
+struct NodeStyle
+{
+    enum Role
+    {
+        None = 0,               //! styled type without effect on its leafs (funct_*)
+        Leafs = 1,              //! style of my leafs
+        FunctCall = 2,          //! style of name of called function (my first leaf)
+        FunctDefinition = 3,    //! style of name of defined function (first leaf of my declarator)
+    };
+
+    Role role;
+    int style;  //! index of style in DocumentScene::styleAt()
+};
 
 class DocumentScene : public QGraphicsScene
 {
@@ -37,7 +61,16 @@ public slots:
     void setGroupLang(Analyzer *newAnalyzer, BlockGroup *group = 0);
     void showPreview(BlockGroup *group = 0);
     void findText(QString searchStr, BlockGroup *group = 0);
+    void findTextLater(QString searchStr);
     void cleanGroup(BlockGroup *group = 0);
+    void updateViewport();
+
+private slots:
+    void textSearchFinished(bool found);
+    void runPendingSearch();
+    void saveProgress(QString fileName, int percent);
+    void groupSaved(BlockGroup *group, QString fileName);
+    void saveFailed(BlockGroup *group, QString fileName, QString error);
 
 public:
     MainWindow *main;
@@ -45,12 +78,15 @@ public:
     void update(const QRectF &rect = QRectF());
     void selectGroup(BlockGroup *group = 0);
     BlockGroup *selectedGroup() const {return currentGroup;}
+    QList<BlockGroup*> groupList() const {return groups;}
     void groupWasModified(BlockGroup *group);
 
     void setHighlighting(const QList<QPair<QString, QHash<QString, QString> > > configData);
     bool hasFormatFor(QString key) const;
     QPair<QFont, QColor> getFormatFor(QString key) const;
-    QPair<QFont, QColor> getDefaultFormat() const;
+    const QPair<QFont, QColor> &getDefaultFormat() const {return defaultStyle;}
+    const NodeStyle *nodeStyle(const QString &type) const;
+    const QPair<QFont, QColor> &styleAt(int index) const {return styles.at(index);}
 
     void print(QString text) const;
     
@@ -74,9 +110,20 @@ private:
     MainWindow *window;
     QList<BlockGroup*> groups;
     BlockGroup *currentGroup;
+    TextSearch *textSearch;     //! running plain text search
+    QTimer *searchTimer;        //! delays search while typing
+    QString pendingSearch;      //! query waiting for searchTimer
+    QPointer<BlockGroup> blockSearchGroup;  //! blocks are searched after text search finds the query
+    QString blockSearchStr;
+    bool blockSearchExact;
+    FileSaver *saver;           //! writes saved files on thread pool
 
     QHash<QString, QPair<QFont, QColor> > highlighting;
+    QVector<QPair<QFont, QColor> > styles;  //! compiled styles, blocks share their fonts
+    QHash<QString, NodeStyle> nodeStyles;   //! compiled style of node types
+    QPair<QFont, QColor> defaultStyle;
 
+    void compileStyles();
     void adjustSceneRect();
     BlockGroup* getBlockGroup();
     bool toBool(QString textBool);
@@ -0,0 +1,173 @@
+/**
+* @file file_saver.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class FileSaver and it's functions and identifiers.
+*/
+
+#include "file_saver.h"
+#include "block_group.h"
+
+#include <QtConcurrentRun>
+#include <QTemporaryFile>
+#include <QTextCodec>
+#include <QFileInfo>
+#include <QDir>
+
+#ifndef Q_OS_WIN
+#include <stdio.h>
+#endif
+
+const int ENCODE_CHUNK = 1 << 20; // characters encoded and written at once
+
+FileSaver::FileSaver(QObject *parent)
+    : QObject(parent)
+{
+}
+
+FileSaver::~FileSaver()
+{
+    blockSignals(true); //! my parent is being destroyed
+    waitForFinished();
+}
+
+/**
+ * Save text of group to fileName, text must be captured by caller.
+ */
+void FileSaver::save(BlockGroup *group, QString fileName, QString text)
+{
+    SaveJob job;
+    job.group = group;
+    job.fileName = QFileInfo(fileName).absoluteFilePath();
+    job.text = text;
+
+    foreach (SaveJob runningJob, running.values())
+    {
+        if (runningJob.fileName == job.fileName)
+        {
+            pending.insert(job.fileName, job); //! replaces older queued text
+            return;
+        }
+    }
+
+    start(job);
+}
+
+void FileSaver::start(const SaveJob &job)
+{
+    QFutureWatcher<SaveResult> *watcher = new QFutureWatcher<SaveResult>(this);
+    connect(watcher, SIGNAL(finished()), this, SLOT(jobFinished()));
+    running.insert(watcher, job);
+    watcher->setFuture(QtConcurrent::run(this, &FileSaver::write, job));
+}
+
+/**
+ * Block until all saves (queued included) are written, used before quitting.
+ */
+void FileSaver::waitForFinished()
+{
+    while (!running.isEmpty())
+    {
+        QFutureWatcher<SaveResult> *watcher = running.keys().first();
+        watcher->waitForFinished();
+        finish(watcher);
+    }
+}
+
+/**
+ * Encode and write text to temporary file in target directory, then rename it over target.
+ */
+SaveResult FileSaver::write(const SaveJob &job)
+{
+    SaveResult result;
+    result.fileName = job.fileName;
+
+    QFileInfo info(job.fileName);
+    QTemporaryFile file(info.absoluteDir().filePath(info.fileName() + ".XXXXXX"));
+
+    if (!file.open())
+    {
+        result.error = file.errorString();
+        return result;
+    }
+
+    QTextEncoder *encoder = QTextCodec::codecForLocale()->makeEncoder();
+    int length = job.text.length();
+    int lastPercent = -1;
+
+    for (int from = 0; from < length && result.error.isEmpty(); from += ENCODE_CHUNK)
+    {
+        int size = qMin(ENCODE_CHUNK, length - from);
+        QByteArray bytes = encoder->fromUnicode(job.text.constData() + from, size);
+
+        if (file.write(bytes) != bytes.size())
+            result.error = file.errorString();
+
+        int percent = (int)((qint64)(from + size) * 100 / length);
+
+        if (percent != lastPercent)
+        {
+            emit progress(job.fileName, percent);  //! queued to GUI thread
+            lastPercent = percent;
+        }
+    }
+
+    delete encoder;
+
+    if (result.error.isEmpty() && !file.flush())
+        result.error = file.errorString();
+
+    if (!result.error.isEmpty()) return result;  //! temporary file is removed
+
+    if (info.exists())
+        file.setPermissions(QFile(job.fileName).permissions());
+
+    file.setAutoRemove(false);
+    QString tempName = file.fileName();
+    file.close();
+
+#ifdef Q_OS_WIN
+    // rename can't replace existing file here
+    QFile::remove(job.fileName);
+    bool renamed = QFile::rename(tempName, job.fileName);
+#else
+    bool renamed = ::rename(QFile::encodeName(tempName).constData(),
+                            QFile::encodeName(job.fileName).constData()) == 0;
+#endif
+
+    if (!renamed)
+    {
+        QFile::remove(tempName);
+        result.error = tr("Cannot replace file");
+    }
+
+    return result;
+}
+
+void FileSaver::jobFinished()
+{
+    finish(static_cast<QFutureWatcher<SaveResult>*>(sender()));
+}
+
+/**
+ * Report result of finished save and start queued save of the same file.
+ */
+void FileSaver::finish(QFutureWatcher<SaveResult> *watcher)
+{
+    if (!running.contains(watcher)) return;
+
+    SaveJob job = running.take(watcher);
+    SaveResult result = watcher->result();
+    watcher->disconnect(this);
+    watcher->deleteLater();
+
+    if (pending.contains(job.fileName))
+        start(pending.take(job.fileName));
+
+    if (result.error.isEmpty())
+        emit saved(job.group, result.fileName);
+    else
+        emit failed(job.group, result.fileName, result.error);
+}
@@ -0,0 +1,73 @@
+/**
+ * file_saver.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class FileSaver and it's funtions and identifiers
+ *
+ */
+
+#ifndef FILE_SAVER_H
+#define FILE_SAVER_H
+
+#include <QObject>
+#include <QString>
+#include <QHash>
+#include <QPointer>
+#include <QFutureWatcher>
+
+class BlockGroup;
+
+/**
+ * Text of one group captured when save was requested.
+ */
+struct SaveJob
+{
+    QPointer<BlockGroup> group;     //! group may be closed while saving
+    QString fileName;
+    QString text;
+};
+
+/**
+ * Outcome of one save, error is empty on success.
+ */
+struct SaveResult
+{
+    QString fileName;
+    QString error;
+};
+
+/**
+ * Saves texts on thread pool. Text is encoded in chunks to a temporary file next
+ * to the target, which then replaces the target by rename, so the target is never
+ * left half written. Different files are saved in parallel, saves of one file
+ * are queued and only the newest queued text is written.
+ */
+class FileSaver : public QObject
+{
+    Q_OBJECT
+
+public:
+    FileSaver(QObject *parent = 0);
+    ~FileSaver();
+
+    void save(BlockGroup *group, QString fileName, QString text);
+    bool isSaving() const {return !running.isEmpty();}
+    void waitForFinished();
+
+signals:
+    void progress(QString fileName, int percent);
+    void saved(BlockGroup *group, QString fileName);
+    void failed(BlockGroup *group, QString fileName, QString error);
+
+private slots:
+    void jobFinished();
+
+private:
+    void start(const SaveJob &job);
+    void finish(QFutureWatcher<SaveResult> *watcher);
+    SaveResult write(const SaveJob &job);   //! runs on thread pool
+
+    QHash<QFutureWatcher<SaveResult>*, SaveJob> running;
+    QHash<QString, SaveJob> pending;        //! next save of file being saved
+};
+
+#endif // FILE_SAVER_H
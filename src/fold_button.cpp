@@ -42,7 +42,7 @@ void FoldButton::updatePos() {
 
         if (myBlock->getAncestorWhereFirst() != lineStart)
         {
-            x = myBlock->mapFromItem(lineStart, 0, 0).x();
+            x = lineStart->posInGroup().x() - myBlock->posInGroup().x();  //! either may be out of scene
         }
     }
 
@@ -52,16 +52,6 @@ void FoldButton::updatePos() {
 
 void FoldButton::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
-    if (myBlock->isFolded())
-    {
-        myBlock->setFolded(false);
-        setPixmap(minus);
-    }
-    else
-    {
-        myBlock->setFolded(true);
-        setPixmap(plus);
-    }
-
+    myBlock->setFolded(!myBlock->isFolded());  //! block updates my pixmap
     event->accept();
 }
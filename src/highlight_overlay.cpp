@@ -0,0 +1,132 @@
+/**
+* @file highlight_overlay.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class HighlightOverlay and it's functions and identifiers.
+*/
+
+#include "highlight_overlay.h"
+
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+HighlightOverlay::HighlightOverlay(QGraphicsItem *parent)
+    : QGraphicsItem(parent)
+{
+    color.setNamedColor("yellow");
+    color.setAlpha(100);
+
+    setZValue(5);   //! over blocks, under insert cues
+    setAcceptedMouseButtons(0);
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+}
+
+/**
+ * Returns index of first highlighted line not less than line.
+ */
+int HighlightOverlay::lowerBound(int line) const
+{
+    int low = 0;
+    int high = lines.size();
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+
+        if (lines.at(mid) < line)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/**
+ * Highlight ascending newLines by newRects, lines already highlighted are kept.
+ * Both arrays are merged in one pass, geometry changes once per call.
+ */
+void HighlightOverlay::addLines(const QVector<int> &newLines, const QVector<QRectF> &newRects)
+{
+    if (newLines.isEmpty()) return;
+
+    QVector<int> mergedLines;
+    QVector<QRectF> mergedRects;
+    mergedLines.reserve(lines.size() + newLines.size());
+    mergedRects.reserve(lines.size() + newLines.size());
+    QRectF added;
+    int i = 0, j = 0;
+
+    while (i < lines.size() || j < newLines.size())
+    {
+        if (j == newLines.size() || (i < lines.size() && lines.at(i) <= newLines.at(j)))
+        {
+            if (j < newLines.size() && lines.at(i) == newLines.at(j)) j++;
+
+            mergedLines << lines.at(i);
+            mergedRects << rects.at(i);
+            i++;
+        }
+        else
+        {
+            mergedLines << newLines.at(j);
+            mergedRects << newRects.at(j);
+            added |= newRects.at(j);
+            j++;
+        }
+    }
+
+    prepareGeometryChange();
+    lines = mergedLines;
+    rects = mergedRects;
+    bounds |= added;
+    update(added);
+}
+
+bool HighlightOverlay::hasLine(int line) const
+{
+    int index = lowerBound(line);
+    return index < lines.size() && lines.at(index) == line;
+}
+
+void HighlightOverlay::clear()
+{
+    if (lines.isEmpty()) return;
+
+    prepareGeometryChange();
+    lines.clear();
+    rects.clear();
+    bounds = QRectF();
+}
+
+void HighlightOverlay::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+
+    QRectF exposed = option->exposedRect;
+
+    // rects of ascending lines are ordered top to bottom, skip those above exposed rect
+    int low = 0;
+    int high = rects.size();
+
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+
+        if (rects.at(mid).bottom() < exposed.top())
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    painter->setPen(Qt::NoPen);
+    painter->setBrush(color);
+
+    for (int i = low; i < rects.size() && rects.at(i).top() <= exposed.bottom(); i++)
+    {
+        if (rects.at(i).intersects(exposed))
+            painter->drawRect(rects.at(i));
+    }
+}
@@ -0,0 +1,46 @@
+/**
+ * highlight_overlay.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class HighlightOverlay and it's funtions and identifiers
+ *
+ */
+
+#ifndef HIGHLIGHT_OVERLAY_H
+#define HIGHLIGHT_OVERLAY_H
+
+#include <QGraphicsItem>
+#include <QVector>
+#include <QColor>
+
+/**
+ * One item painting all highlighted lines of a block group. Rectangles are kept
+ * in array sorted by line, only those intersecting exposed rect are painted.
+ */
+class HighlightOverlay : public QGraphicsItem
+{
+public:
+    HighlightOverlay(QGraphicsItem *parent);
+
+    enum { Type = UserType + 5 };
+    int type() const {return Type;}
+
+    void addLines(const QVector<int> &newLines, const QVector<QRectF> &newRects);
+    bool hasLine(int line) const;
+    void clear();
+    bool isEmpty() const {return lines.isEmpty();}
+    int count() const {return lines.size();}
+
+    QRectF boundingRect() const {return bounds;}
+    QPainterPath shape() const {return QPainterPath();} //! never hit by mouse
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+
+private:
+    int lowerBound(int line) const;
+
+    QVector<int> lines;     //! highlighted lines, ascending
+    QVector<QRectF> rects;  //! rect of line at same index
+    QRectF bounds;
+    QColor color;
+};
+
+#endif // HIGHLIGHT_OVERLAY_H
@@ -18,6 +18,10 @@
 #include "tips_tricks.h"
 #include "analyzer.h"
 #include "block_group.h"
+#include "block.h"
+#include "tree_element.h"
+#include "search_dock.h"
+#include "benchmark.h"
 #include <QTableWidget>
 #include <QFont>
 #include <QPushButton>
@@ -445,6 +449,8 @@ static int l_revertAction(lua_State *L) {
 MainWindow::MainWindow(QString programPath, QWidget *parent) : QMainWindow(parent)
 {
     langManager = new LanguageManager(programPath);
+    searchDock = 0;
+    replaceWindow = 0;
 
     createActions();
     initLuaState(programPath);
@@ -752,6 +758,14 @@ void MainWindow::createActions()
     metricsAction->setStatusTip(tr("Dispaly of sw metrics"));
     connect(metricsAction, SIGNAL(triggered()), this, SLOT(swMetrics()));
 
+    //! benchmark
+    benchmarkFileAction = new QAction(tr("&Generate benchmark file..."), this);
+    benchmarkFileAction->setStatusTip(tr("Open generated C file of given size"));
+    connect(benchmarkFileAction, SIGNAL(triggered()), this, SLOT(generateBenchmarkFile()));
+    benchmarkAction = new QAction(tr("&Run benchmark"), this);
+    benchmarkAction->setStatusTip(tr("Measure editor operations on current document"));
+    connect(benchmarkAction, SIGNAL(triggered()), this, SLOT(runBenchmark()));
+
     //! task list
     QIcon taskIcon(":/icons/taskList.png");
     taskListAction = new QAction(taskIcon,tr("&Task list"), this);
@@ -827,6 +841,34 @@ void MainWindow::createActions()
     splitAction->setCheckable(true);
     connect(splitAction, SIGNAL(triggered()), this, SLOT(split()));
 
+    //! fold all
+    foldAllAction = new QAction(tr("&Fold all"), this);
+    foldAllAction->setShortcut(tr("CTRL+K, CTRL+F"));    //! letters only, same keys on every layout
+    foldAllAction->setStatusTip(tr("Fold all foldable blocks"));
+    connect(foldAllAction, SIGNAL(triggered()), this, SLOT(foldAll()));
+    addAction(foldAllAction);
+
+    //! unfold all
+    unfoldAllAction = new QAction(tr("&Unfold all"), this);
+    unfoldAllAction->setShortcut(tr("CTRL+K, CTRL+U"));
+    unfoldAllAction->setStatusTip(tr("Unfold all folded blocks"));
+    connect(unfoldAllAction, SIGNAL(triggered()), this, SLOT(unfoldAll()));
+    addAction(unfoldAllAction);
+
+    //! fold to level
+    foldLevelAction = new QAction(tr("Fold to &level..."), this);
+    foldLevelAction->setShortcut(tr("CTRL+SHIFT+L"));
+    foldLevelAction->setStatusTip(tr("Fold blocks nested deeper than given level"));
+    connect(foldLevelAction, SIGNAL(triggered()), this, SLOT(foldToLevel()));
+    addAction(foldLevelAction);
+
+    //! fold by type
+    foldTypeAction = new QAction(tr("Fold blocks of selected &type"), this);
+    foldTypeAction->setShortcut(tr("CTRL+SHIFT+T"));
+    foldTypeAction->setStatusTip(tr("Fold all blocks of the same type as selected block"));
+    connect(foldTypeAction, SIGNAL(triggered()), this, SLOT(foldSelectedType()));
+    addAction(foldTypeAction);
+
     //! CMD
     QIcon cmdIcon(":/icons/cmd.png");
     showCmdAction = new QAction(cmdIcon,tr("&CMD"), this);
@@ -915,6 +957,12 @@ void MainWindow::createActions()
     find_ReplaceAction->setStatusTip(tr("Find and Replace"));
     connect(find_ReplaceAction, SIGNAL(triggered()), this, SLOT(find_Replace()));
 
+    //! find in open files
+    findInFilesAction = new QAction(tr("Find in &open files"), this);
+    findInFilesAction->setShortcut(tr("CTRL+SHIFT+F"));
+    findInFilesAction->setStatusTip(tr("Find in all open files"));
+    connect(findInFilesAction, SIGNAL(triggered()), this, SLOT(findInFiles()));
+
     //! set bold font
     QIcon boldIcon(":/icons/bold.png");
     setBoldAction = new QAction(boldIcon,tr("&Bold font"), this);
@@ -981,6 +1029,7 @@ void MainWindow::createMenus()
     editMenu->addSeparator();
     editMenu->addAction(findAction);
     editMenu->addAction(find_ReplaceAction);
+    editMenu->addAction(findInFilesAction);
 
     //! View menu
     viewMenu = menuBar()->addMenu(tr("&View"));
@@ -1002,6 +1051,13 @@ void MainWindow::createMenus()
     viewMenu->addSeparator();
     viewMenu->addAction(zoomInAction);
     viewMenu->addAction(zoomOutAction);
+    viewMenu->addSeparator();
+    //! submenu folding
+    foldingMenu = viewMenu->addMenu("F&olding");
+    foldingMenu->addAction(foldAllAction);
+    foldingMenu->addAction(unfoldAllAction);
+    foldingMenu->addAction(foldLevelAction);
+    foldingMenu->addAction(foldTypeAction);
 
     //! tolls menu
     tollsMenu = menuBar()->addMenu(tr("&Tools"));
@@ -1019,6 +1075,10 @@ void MainWindow::createMenus()
     generateMenu= tollsMenu->addMenu(tr("&Generate to"));
     generateMenu->addAction(printPdfAction);
     generateMenu->addAction(snapshotAction);
+    //! submenu benchmark
+    benchmarkMenu = tollsMenu->addMenu(tr("&Benchmark"));
+    benchmarkMenu->addAction(benchmarkFileAction);
+    benchmarkMenu->addAction(benchmarkAction);
     
     tollsMenu->addAction(shortAction);
     
@@ -1162,14 +1222,14 @@ void MainWindow::createToolBars()
 
         searchLineEdit = new QLineEdit();
         searchLineEdit->setFixedSize(150, 20);
-        searchLineEdit->setToolTip(tr("For result press Enter"));
+        searchLineEdit->setToolTip(tr("Results are shown as you type"));
         searchLineEdit->setText("search");
         searchLineEdit->setStyleSheet( "QLineEdit{"
                                        "color: black;"
                                        "font-style: italic;"
                                        "border-radius: 5px;"
                                        "}");
-        connect(searchLineEdit, SIGNAL(editingFinished()), this, SLOT(search()));
+        connect(searchLineEdit, SIGNAL(textEdited(QString)), this, SLOT(search()));  //! search as you type
         formatToolBar->addWidget(searchLineEdit);
         formatToolBar->addAction(clearAction);
         formatToolBar->addAction(aboutAction);
@@ -1300,6 +1360,9 @@ QGraphicsView* MainWindow::createView()
     connect(scene, SIGNAL(fileSelected(BlockGroup*)),
             this, SLOT(setCurrentFile(BlockGroup*))); // CHECK
     view->setScene(scene);
+    // only visible part of document keeps cached texts, refresh them on scroll
+    connect(view->verticalScrollBar(), SIGNAL(valueChanged(int)), scene, SLOT(updateViewport()));
+    connect(view->verticalScrollBar(), SIGNAL(rangeChanged(int,int)), scene, SLOT(updateViewport()));
     return view;
 }
 
@@ -1547,7 +1610,7 @@ void MainWindow::search()
     try
     {
         QString searchText = searchLineEdit->text();
-        getScene()->findText(searchText);
+        getScene()->findTextLater(searchText);  //! search starts when typing pauses
     }
     catch (...)
     {
@@ -1600,6 +1663,9 @@ void MainWindow::printPdf()
 
     if(printableAreaAction->isChecked()) hideArea();
 
+    foreach (BlockGroup *group, scene->groupList())
+        group->wakeAll();   //! blocks far from viewport are out of scene
+
 //    for(int i=0; i<10; i++){
     while(endCondition)
     {
@@ -1748,7 +1814,7 @@ void MainWindow::find()
   findWindow = new QDialog();
   findLabel = new QLabel("Inser keyword:");
   findLineEdit = new QLineEdit();
-  connect(findLineEdit, SIGNAL(editingFinished()), this, SLOT(search2()));
+  connect(findLineEdit, SIGNAL(textEdited(QString)), this, SLOT(search2()));  //! search as you type
   findLineEdit->setStyleSheet("QLineEdit{"
                               "color: black;"
                               "font-style: italic;"
@@ -1773,7 +1839,7 @@ void MainWindow::search2()
     try
     {
         QString searchText2 = findLineEdit->text();
-        getScene()->findText(searchText2);
+        getScene()->findTextLater(searchText2); //! search starts when typing pauses
     }
     catch (...)
     {
@@ -1781,9 +1847,163 @@ void MainWindow::search2()
     }
 }
 
+//! dialog is created on first use and kept, later calls only bring it up
 void MainWindow::find_Replace()
 {
-  QMessageBox::information(this,"title","On Function is working!");
+  if (replaceWindow != 0)
+  {
+      updateReplaceScopes();
+      replaceWindow->show();
+      replaceWindow->raise();
+      replaceWindow->activateWindow();
+      replaceFindEdit->setFocus();
+      return;
+  }
+
+  replaceWindow = new QDialog(this);
+  replaceFindEdit = new QLineEdit();
+  replaceWithEdit = new QLineEdit();
+  replaceTypeEdit = new QLineEdit();
+  replaceTypeEdit->setToolTip(tr("Replace only inside nodes of this type (e.g. identifier), empty for all"));
+  replaceScopeBox = new QComboBox();
+  replaceScopeBox->addItem(tr("Whole document"));
+  replaceScopeBox->addItem(tr("Selected block"));
+  replaceScopeBox->addItem(tr("Current function"));
+  replaceWordsBox = new QCheckBox(tr("Whole words only"));
+  replaceWordsBox->setChecked(true);
+  updateReplaceScopes();
+  QPushButton *replaceButton = new QPushButton(tr("Replace all"));
+  connect(replaceButton, SIGNAL(clicked()), this, SLOT(replaceAll()));
+
+  QGridLayout *grid = new QGridLayout(replaceWindow);
+  grid->addWidget(new QLabel(tr("Find:")), 0, 0);
+  grid->addWidget(replaceFindEdit, 0, 1);
+  grid->addWidget(new QLabel(tr("Replace with:")), 1, 0);
+  grid->addWidget(replaceWithEdit, 1, 1);
+  grid->addWidget(new QLabel(tr("Scope:")), 2, 0);
+  grid->addWidget(replaceScopeBox, 2, 1);
+  grid->addWidget(new QLabel(tr("Node type:")), 3, 0);
+  grid->addWidget(replaceTypeEdit, 3, 1);
+  grid->addWidget(replaceWordsBox, 4, 1);
+  grid->addWidget(replaceButton, 5, 1);
+  replaceWindow->resize(430, 170);
+  replaceWindow->setWindowTitle("Find and replace");
+  replaceWindow->show();
+}
+
+//! "Current function" scope is offered only if grammar of current document names its function node
+void MainWindow::updateReplaceScopes()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+    bool hasFunctions = group != 0 && !group->getAnalyzer()->getFunctionToken().isEmpty();
+    QStandardItemModel *scopes = qobject_cast<QStandardItemModel*>(replaceScopeBox->model());
+
+    if (scopes != 0)
+        scopes->item(2)->setEnabled(hasFunctions);
+
+    if (!hasFunctions && replaceScopeBox->currentIndex() == 2)
+        replaceScopeBox->setCurrentIndex(0);
+}
+
+//! replace in tokens of chosen scope, document is reanalysed once after all replacements
+void MainWindow::replaceAll()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+
+    if (group == 0 || replaceWindow == 0 || replaceFindEdit->text().isEmpty()) return;
+
+    Block *scope = 0;
+
+    if (replaceScopeBox->currentIndex() > 0)
+    {
+        scope = group->selectedBlock();
+
+        if (replaceScopeBox->currentIndex() == 2) //! function containing selection
+        {
+            QString functionToken = group->getAnalyzer()->getFunctionToken();
+
+            if (functionToken.isEmpty())
+            {
+                statusBar()->showMessage(tr("Language has no functions, choose other scope"), 2000);
+                updateReplaceScopes();
+                return;
+            }
+
+            while (scope != 0 && scope->getElement()->getType() != functionToken)
+                scope = scope->parentBlock();
+        }
+
+        if (scope == 0)
+        {
+            statusBar()->showMessage(tr("Nothing to replace in, select a block first"), 2000);
+            return;
+        }
+    }
+
+    int count = group->replaceAll(replaceFindEdit->text(), replaceWithEdit->text(),
+                                  scope, replaceTypeEdit->text().trimmed(),
+                                  replaceWordsBox->isChecked());
+    statusBar()->showMessage(tr("Replaced in %1 tokens").arg(count), 2000);
+}
+
+//! search in all documents of all tabs, results are listed in search dock
+void MainWindow::findInFiles()
+{
+    bool ok;
+    QString pattern = QInputDialog::getText(this, tr("Find in open files"),
+                                            tr("Keyword or /regular expression/:"),
+                                            QLineEdit::Normal, QString(), &ok);
+
+    if (!ok || pattern.isEmpty()) return;
+
+    QList<BlockGroup*> groups;
+
+    for (int i = 0; i < tabWidget->count(); i++)
+    {
+        QGraphicsView *view = (QGraphicsView *) tabWidget->widget(i);
+        DocumentScene *dScene = (DocumentScene *) view->scene();
+
+        foreach (BlockGroup *group, dScene->groupList())
+        {
+            if (!groups.contains(group)) groups << group;
+        }
+    }
+
+    if (groups.isEmpty())
+    {
+        statusBar()->showMessage(tr("No open files"), 2000);
+        return;
+    }
+
+    if (searchDock == 0)
+    {
+        searchDock = new SearchDock(this);
+        connect(searchDock, SIGNAL(jumpTo(BlockGroup*,int)), this, SLOT(jumpToBlock(BlockGroup*,int)));
+        addDockWidget(Qt::BottomDockWidgetArea, searchDock);
+    }
+
+    searchDock->show();
+    searchDock->search(groups, pattern);
+}
+
+//! show tab of group and select block in line
+void MainWindow::jumpToBlock(BlockGroup *group, int line)
+{
+    for (int i = 0; i < tabWidget->count(); i++)
+    {
+        QGraphicsView *view = (QGraphicsView *) tabWidget->widget(i);
+
+        if (view->scene() != group->docScene) continue;
+
+        tabWidget->setCurrentIndex(i);
+        group->docScene->selectGroup(group);
+
+        Block *block = group->getBlockIn(qMin(line, group->getLastLine()));
+        group->selectBlock(block, true);
+        view->ensureVisible(block, 50, 50);
+        view->setFocus();
+        return;
+    }
 }
 
 //! END OF FUNCTIONS FOR EDIT MENU -------------------------------------------------------------------------
@@ -1886,6 +2106,54 @@ void MainWindow::zoomOut()
     getScene()->adjustScale(-1.2);
 }
 
+void MainWindow::foldAll()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+
+    if (group != 0) group->foldBlocks(1);
+}
+
+void MainWindow::unfoldAll()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+
+    if (group != 0) group->foldBlocks(0);
+}
+
+void MainWindow::foldToLevel()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+
+    if (group == 0) return;
+
+    bool ok;
+    int level = QInputDialog::getInt(this, tr("Fold to level"), tr("Fold blocks from nesting level:"),
+                                     1, 1, 100, 1, &ok);
+
+    if (ok) group->foldBlocks(level);
+}
+
+//! fold all blocks of same type as selected block (or its closest foldable ancestor)
+void MainWindow::foldSelectedType()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+
+    if (group == 0) return;
+
+    Block *block = group->selectedBlock();
+
+    while (block != 0 && !block->isFoldable())
+        block = block->parentBlock();
+
+    if (block == 0)
+    {
+        statusBar()->showMessage(tr("Select a foldable block first"), 2000);
+        return;
+    }
+
+    group->foldBlocks(1, block->getElement()->getType());
+}
+
 //! split
 void MainWindow::split()
 {
@@ -1948,6 +2216,49 @@ void MainWindow::swMetrics()
     QMessageBox::information(this,"title","On Function is working!");
 }
 
+//! write flat C file of chosen size to temp dir and open it, for benchmarks
+void MainWindow::generateBenchmarkFile()
+{
+    bool ok;
+    int statements = QInputDialog::getInt(this, tr("Generate benchmark file"), tr("Statements:"),
+                                          50000, 1, 1000000, 1000, &ok);
+    if (!ok) return;
+
+    QString fileName = QDir::temp().filePath(QString("trolledit_benchmark_%1.c").arg(statements));
+    QFile file(fileName);
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
+    {
+        QMessageBox::warning(this, tr("TrollEdit"), tr("Cannot write file %1:\n%2.")
+                             .arg(fileName).arg(file.errorString()));
+        return;
+    }
+
+    QTextStream out(&file);
+    out << Benchmark::generateC(statements);
+    file.close();
+
+    open(fileName);
+}
+
+//! measure editor operations on current document, results are printed with qDebug too
+void MainWindow::runBenchmark()
+{
+    BlockGroup *group = getScene()->selectedGroup();
+
+    if (group == 0)
+    {
+        statusBar()->showMessage(tr("Open a document first"), 2000);
+        return;
+    }
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    QString results = Benchmark(group).run();
+    QApplication::restoreOverrideCursor();
+
+    QMessageBox::information(this, tr("Benchmark"), results);
+}
+
 //! rum CMD
 void MainWindow::showCmd()
 {
@@ -36,6 +36,7 @@ class BlockGroup;
 class QTableWidget;
 class QTableWidgetItem;
 class QDialog;
+class SearchDock;
 
 class MainWindow : public QMainWindow
 {
@@ -83,6 +84,7 @@ public:
     QAction *selectAllAction;
     QAction *findAction;
     QAction *find_ReplaceAction;
+    QAction *findInFilesAction;
 
     // for help menu
     QAction *homePageAction;
@@ -104,11 +106,17 @@ public:
     QAction *editorToolbarAction;
     QAction *setBottomDockAction;
     QAction *setRightDockAction;
+    QAction *foldAllAction;
+    QAction *unfoldAllAction;
+    QAction *foldLevelAction;
+    QAction *foldTypeAction;
 
     // for tools menu
     QAction *shortAction;
     QAction *optionsAction;
     QAction *metricsAction;
+    QAction *benchmarkFileAction;
+    QAction *benchmarkAction;
     QAction *setCAction;
     QAction *setLuaAction;
     QAction *setXmlAction;
@@ -128,10 +136,12 @@ public:
     QMenu *tollsMenu;
     QMenu *helpMenu;
     QMenu *generateMenu;
+    QMenu *benchmarkMenu;
     QMenu *toolbarsMenu;
     QMenu *languageMenu;
     QMenu *setToolbarsMenu;
     QMenu *panelsMenu;
+    QMenu *foldingMenu;
 
     QToolBar *formatToolBar;
     QToolBar *editorToolbars;
@@ -186,10 +196,17 @@ private slots:
     void selectAll();
     void find();
     void find_Replace();
+    void replaceAll();
+    void findInFiles();
+    void jumpToBlock(BlockGroup *group, int line);
     void showCmd();
     void newWindow();
     void zoomIn();
     void zoomOut();
+    void foldAll();
+    void unfoldAll();
+    void foldToLevel();
+    void foldSelectedType();
     void split();
     void snapshot();
     void bugList();
@@ -215,6 +232,8 @@ private slots:
 
     void printPdf();
     void swMetrics();
+    void generateBenchmarkFile();
+    void runBenchmark();
     void showPrintableArea();
     void setShort();
     void savedShortcuts();
@@ -244,6 +263,14 @@ private:
     QLineEdit *findLineEdit;
     QHBoxLayout *layout;
 
+    // for function find and replace, dialog is owned by main window and reused
+    QDialog *replaceWindow;
+    QLineEdit *replaceFindEdit;
+    QLineEdit *replaceWithEdit;
+    QLineEdit *replaceTypeEdit;
+    QComboBox *replaceScopeBox;
+    QCheckBox *replaceWordsBox;
+
     QWidget *notepad;
 
     QDirModel *model;
@@ -256,6 +283,7 @@ private:
     QDockWidget *dock;
     QTextEdit *text;
     QDockWidget *dock1;
+    SearchDock *searchDock;     //! results of search in open files, created on first use
 
 
     LanguageManager *langManager;
@@ -283,6 +311,7 @@ private:
     QString strippedName(const QString &fullFileName);
     void updateRecentFileActions();
     void load(QString fileName);
+    void updateReplaceScopes();
 
     void showArea();
     void hideArea();
@@ -0,0 +1,120 @@
+/**
+* @file plain_text_layout.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class PlainTextLayout and it's functions and identifiers.
+*/
+
+#include "plain_text_layout.h"
+
+#include <QPainter>
+#include <QTextBlock>
+#include <QTextLayout>
+#include <QFontMetricsF>
+
+PlainTextLayout::PlainTextLayout(QTextDocument *document)
+    : QPlainTextDocumentLayout(document)
+{
+}
+
+/**
+ * Height of one line, all lines share default font of document.
+ */
+qreal PlainTextLayout::lineHeight() const
+{
+    QTextBlock block = document()->firstBlock();
+    ensureBlockLayout(block);
+
+    if (block.layout()->lineCount() > 0)
+        return block.layout()->lineAt(0).height();
+
+    return QFontMetricsF(document()->defaultFont()).height();
+}
+
+QSizeF PlainTextLayout::documentSize() const
+{
+    QSizeF size = QPlainTextDocumentLayout::documentSize();    //! height in lines
+    return QSizeF(size.width(), size.height() * lineHeight());
+}
+
+QRectF PlainTextLayout::blockBoundingRect(const QTextBlock &block) const
+{
+    if (!block.isValid()) return QRectF();
+
+    ensureBlockLayout(block);
+    qreal height = lineHeight();
+
+    return QRectF(0, block.firstLineNumber() * height,
+                  QPlainTextDocumentLayout::documentSize().width(), qMax(1, block.lineCount()) * height);
+}
+
+int PlainTextLayout::hitTest(const QPointF &point, Qt::HitTestAccuracy accuracy) const
+{
+    Q_UNUSED(accuracy);
+
+    int line = qBound(0, int(point.y() / lineHeight()), document()->lineCount() - 1);
+    QTextBlock block = document()->findBlockByLineNumber(line);
+
+    if (!block.isValid()) return -1;
+
+    ensureBlockLayout(block);
+    QTextLayout *layout = block.layout();
+    QPointF pos = point - blockBoundingRect(block).topLeft();
+
+    for (int i = 0; i < layout->lineCount(); i++)
+    {
+        QTextLine textLine = layout->lineAt(i);
+
+        if (pos.y() < textLine.y() + textLine.height() || i == layout->lineCount() - 1)
+            return block.position() + textLine.xToCursor(pos.x());
+    }
+
+    return block.position();
+}
+
+/**
+ * Draw blocks intersecting clip only, first of them is found by line number.
+ */
+void PlainTextLayout::draw(QPainter *painter, const PaintContext &context)
+{
+    QRectF clip = context.clip.isValid() ? context.clip : QRectF(QPointF(), documentSize());
+    int firstLine = qMax(0, int(clip.top() / lineHeight()));
+    QTextBlock block = document()->findBlockByLineNumber(qMin(firstLine, document()->lineCount() - 1));
+
+    painter->setPen(context.palette.color(QPalette::Text));
+
+    while (block.isValid())
+    {
+        QRectF rect = blockBoundingRect(block);
+
+        if (rect.top() > clip.bottom()) break;
+
+        int start = block.position();
+        int length = block.length();
+        QVector<QTextLayout::FormatRange> selections;
+
+        foreach (const Selection &selection, context.selections)
+        {
+            int from = selection.cursor.selectionStart() - start;
+            int to = selection.cursor.selectionEnd() - start;
+
+            if (from < length && to > 0 && from < to)
+            {
+                QTextLayout::FormatRange range;
+                range.start = qMax(from, 0);
+                range.length = qMin(to, length) - range.start;
+                range.format = selection.format;
+                selections << range;
+            }
+        }
+
+        block.layout()->draw(painter, rect.topLeft(), selections, clip);
+
+        if (context.cursorPosition >= start && context.cursorPosition < start + length)
+            block.layout()->drawCursor(painter, rect.topLeft(), context.cursorPosition - start, cursorWidth());
+
+        block = block.next();
+    }
+}
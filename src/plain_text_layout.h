@@ -0,0 +1,34 @@
+/**
+ * plain_text_layout.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class PlainTextLayout and it's funtions and identifiers
+ *
+ */
+
+#ifndef PLAIN_TEXT_LAYOUT_H
+#define PLAIN_TEXT_LAYOUT_H
+
+#include <QPlainTextDocumentLayout>
+
+/**
+ * Paragraph layout of text mode. Like QPlainTextEdit every line is laid out on its
+ * own, without frames or pagination. Unwrapped lines of one font have the same
+ * height, so geometry of any block is computed from its line number and only
+ * blocks in painted area are drawn. Unlike QPlainTextDocumentLayout it places
+ * blocks itself, so it can be used by QGraphicsTextItem.
+ */
+class PlainTextLayout : public QPlainTextDocumentLayout
+{
+public:
+    PlainTextLayout(QTextDocument *document);
+
+    void draw(QPainter *painter, const PaintContext &context);
+    int hitTest(const QPointF &point, Qt::HitTestAccuracy accuracy) const;
+    QRectF blockBoundingRect(const QTextBlock &block) const;
+    QSizeF documentSize() const;
+
+private:
+    qreal lineHeight() const;
+};
+
+#endif // PLAIN_TEXT_LAYOUT_H
@@ -0,0 +1,168 @@
+/**
+* @file search_dock.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class SearchDock and it's functions and identifiers.
+*/
+
+#include "search_dock.h"
+#include "block_group.h"
+#include "text_search.h"
+
+#include <QtConcurrentMap>
+#include <QFileInfo>
+#include <QHeaderView>
+
+const int MAX_SHOWN_TEXT = 200; // characters of matched line shown in results
+
+SearchDock::SearchDock(QWidget *parent)
+    : QDockWidget(tr("Search results"), parent)
+{
+    setObjectName("searchDock");
+    setAllowedAreas(Qt::TopDockWidgetArea | Qt::BottomDockWidgetArea);
+    setFeatures(QDockWidget::DockWidgetClosable);
+
+    results = new QTreeWidget(this);
+    results->setColumnCount(2);
+    results->setHeaderLabels(QStringList() << tr("File / line") << tr("Text"));
+    results->header()->setResizeMode(0, QHeaderView::ResizeToContents);
+    results->setUniformRowHeights(true);
+    setWidget(results);
+
+    matchCount = 0;
+
+    connect(results, SIGNAL(itemActivated(QTreeWidgetItem*,int)), this, SLOT(itemActivated(QTreeWidgetItem*,int)));
+    connect(&watcher, SIGNAL(resultReadyAt(int)), this, SLOT(fileReady(int)));
+    connect(&watcher, SIGNAL(finished()), this, SLOT(allReady()));
+}
+
+SearchDock::~SearchDock()
+{
+    cancel();
+    watcher.waitForFinished();
+}
+
+/**
+ * Search pattern in groups, pattern in /slashes/ is regular expression.
+ * Snapshots are taken here, workers never touch the groups.
+ */
+void SearchDock::search(QList<BlockGroup*> groups, QString pattern)
+{
+    cancel();
+    results->clear();
+    searched.clear();
+    fileNames.clear();
+    searchedPattern = pattern;
+    matchCount = 0;
+
+    QList<FileSearchJob> jobs;
+
+    foreach (BlockGroup *group, groups)
+    {
+        FileSearchJob job;
+        job.index = searched.size();
+        job.snapshot = group->snapshot();
+        job.pattern = pattern;
+        jobs << job;
+
+        QString name = group->getFilePath().isEmpty() ? tr("untitled") : QFileInfo(group->getFilePath()).fileName();
+        searched << QPointer<BlockGroup>(group);
+        fileNames << name;
+    }
+
+    setWindowTitle(tr("Searching \"%1\"...").arg(pattern));
+    time.start();
+    watcher.setFuture(QtConcurrent::mapped(jobs, &SearchDock::searchFile));
+}
+
+void SearchDock::cancel()
+{
+    if (watcher.isRunning())
+        watcher.cancel();
+}
+
+/**
+ * Scan one document, runs on thread pool.
+ */
+FileSearchResult SearchDock::searchFile(const FileSearchJob &job)
+{
+    FileSearchResult result;
+    result.index = job.index;
+
+    QString text = job.snapshot.getText(true);
+    result.lines = TextSearch::findLines(text, job.pattern);
+
+    // cut out matched lines, lines are in ascending order
+    int line = 0;
+    int start = 0;
+
+    foreach (int matched, result.lines)
+    {
+        while (line < matched)
+        {
+            start = text.indexOf('\n', start) + 1;
+            line++;
+        }
+
+        int end = text.indexOf('\n', start);
+
+        if (end < 0) end = text.length();
+
+        result.texts << text.mid(start, qMin(end - start, MAX_SHOWN_TEXT)).trimmed();
+    }
+
+    return result;
+}
+
+/**
+ * List matches of finished document, documents are listed in order they finish.
+ */
+void SearchDock::fileReady(int index)
+{
+    if (watcher.isCanceled()) return;
+
+    FileSearchResult result = watcher.resultAt(index);
+
+    if (result.lines.isEmpty()) return;
+
+    QTreeWidgetItem *fileItem = new QTreeWidgetItem(results);
+    fileItem->setText(0, fileNames.at(result.index));
+    fileItem->setText(1, tr("%n match(es)", "", result.lines.size()));
+    fileItem->setData(0, Qt::UserRole, result.index);
+    fileItem->setData(0, Qt::UserRole + 1, -1);
+
+    for (int i = 0; i < result.lines.size(); i++)
+    {
+        QTreeWidgetItem *lineItem = new QTreeWidgetItem(fileItem);
+        lineItem->setText(0, QString::number(result.lines.at(i) + 1));
+        lineItem->setText(1, result.texts.at(i));
+        lineItem->setData(0, Qt::UserRole, result.index);
+        lineItem->setData(0, Qt::UserRole + 1, result.lines.at(i));
+    }
+
+    fileItem->setExpanded(true);
+    matchCount += result.lines.size();
+}
+
+void SearchDock::allReady()
+{
+    if (watcher.isCanceled()) return;
+
+    qDebug("find in open files: %d", time.restart());
+    setWindowTitle(tr("Search results for \"%1\": %2 in %3 file(s)")
+                   .arg(searchedPattern).arg(matchCount).arg(results->topLevelItemCount()));
+}
+
+void SearchDock::itemActivated(QTreeWidgetItem *item, int column)
+{
+    Q_UNUSED(column);
+
+    int index = item->data(0, Qt::UserRole).toInt();
+    int line = item->data(0, Qt::UserRole + 1).toInt();
+
+    if (index >= searched.size() || searched.at(index).isNull()) return;
+
+    emit jumpTo(searched.at(index), qMax(line, 0));
+}
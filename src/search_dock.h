@@ -0,0 +1,79 @@
+/**
+ * search_dock.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class SearchDock and it's funtions and identifiers
+ *
+ */
+
+#ifndef SEARCH_DOCK_H
+#define SEARCH_DOCK_H
+
+#include <QDockWidget>
+#include <QTreeWidget>
+#include <QFutureWatcher>
+#include <QPointer>
+#include <QStringList>
+#include <QTime>
+
+#include "tree_snapshot.h"
+
+class BlockGroup;
+
+/**
+ * Read-only copy of one open document searched by one worker.
+ */
+struct FileSearchJob
+{
+    int index;              //! position of document in searched groups
+    TreeSnapshot snapshot;
+    QString pattern;
+};
+
+/**
+ * Lines of one document containing the pattern.
+ */
+struct FileSearchResult
+{
+    int index;
+    QList<int> lines;
+    QStringList texts;      //! text of matched lines, for results list
+};
+
+/**
+ * Search in all open documents. Every document is scanned by its own worker over
+ * a snapshot of its tree, so the search takes as long as the largest file.
+ * Results are listed per document as soon as its worker is done,
+ * activating a result emits jumpTo.
+ */
+class SearchDock : public QDockWidget
+{
+    Q_OBJECT
+
+public:
+    SearchDock(QWidget *parent = 0);
+    ~SearchDock();
+
+    void search(QList<BlockGroup*> groups, QString pattern);
+    void cancel();
+
+signals:
+    void jumpTo(BlockGroup *group, int line);
+
+private slots:
+    void fileReady(int index);
+    void allReady();
+    void itemActivated(QTreeWidgetItem *item, int column);
+
+private:
+    static FileSearchResult searchFile(const FileSearchJob &job);
+
+    QTreeWidget *results;
+    QFutureWatcher<FileSearchResult> watcher;
+    QList<QPointer<BlockGroup> > searched;  //! documents may be closed while searching
+    QStringList fileNames;
+    QString searchedPattern;
+    int matchCount;
+    QTime time; //! used for benchmarking
+};
+
+#endif // SEARCH_DOCK_H
@@ -0,0 +1,493 @@
+/**
+* @file text_buffer.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class TextBuffer and it's functions and identifiers.
+*/
+
+#include "text_buffer.h"
+#include "tree_element.h"
+#include "doc_block.h"
+
+#include <QtAlgorithms>
+
+const int MIN_COMPACT_SIZE = 4096; // add buffer smaller than this is never compacted
+
+TextBuffer::TextBuffer()
+{
+    root = 0;
+    dirty = true;
+    fullValid = plainValid = false;
+}
+
+TextBuffer::~TextBuffer()
+{
+    setRoot(0);
+}
+
+/**
+ * Attach store to the given tree, previous tree is released. Search index
+ * is built here once, setting the same root again keeps it.
+ */
+void TextBuffer::setRoot(TreeElement *newRoot)
+{
+    releasePieces();
+
+    if (newRoot == root)
+    {
+        if (root != 0)
+            root->textStore = this;
+
+        return;
+    }
+
+    if (root != 0)
+        root->textStore = 0;
+
+    typeIndex.clear();
+    root = newRoot;
+
+    if (root != 0)
+    {
+        root->textStore = this;
+        indexSubtree(root);
+    }
+}
+
+/**
+ * Release all pieces, table is rebuilt on next read.
+ */
+void TextBuffer::releasePieces()
+{
+    foreach (Piece piece, pieces)
+    {
+        if (piece.owner != 0 && piece.owner->textStore == this)
+        {
+            piece.owner->textPiece = -1;
+            piece.owner->textStore = 0;
+        }
+    }
+
+    if (root != 0)
+        root->textStore = 0;    //! root is attached again by setRoot()
+
+    pieces.clear();
+    lengths.clear();
+    plainLengths.clear();
+    original.clear();
+    addBuffer.clear();
+    fullText.clear();
+    plainText.clear();
+    fullValid = plainValid = false;
+    dirty = true;
+}
+
+/**
+ * Returns text of the tree, pieces are joined only when they changed since last call.
+ */
+QString TextBuffer::text(bool noDocs)
+{
+    if (dirty) rebuild();
+
+    QString &cache = noDocs ? plainText : fullText;
+    bool &valid = noDocs ? plainValid : fullValid;
+
+    if (!valid)
+    {
+        cache.clear();
+        cache.reserve(fenwickSum(noDocs ? plainLengths : lengths, pieces.size()));
+
+        foreach (Piece piece, pieces)
+        {
+            if (noDocs && piece.doc) continue;
+
+            cache.append((piece.added ? addBuffer : original).midRef(piece.start, piece.length));
+        }
+
+        valid = true;
+    }
+
+    return cache;
+}
+
+int TextBuffer::length(bool noDocs)
+{
+    if (dirty) rebuild();
+
+    return fenwickSum(noDocs ? plainLengths : lengths, pieces.size());
+}
+
+/**
+ * Replace text of one piece, used when a single leaf changed its text.
+ * @return false if the store is outdated and must be rebuilt anyway
+ */
+bool TextBuffer::replacePiece(int index, const QString &str)
+{
+    if (dirty || index < 0 || index >= pieces.size())
+        return false;
+
+    Piece &piece = pieces[index];
+    int delta = str.length() - piece.length;
+
+    if (piece.owner != 0 && !piece.doc)   //! move edited token in index
+    {
+        removeFromIndex((piece.added ? addBuffer : original).mid(piece.start, piece.length), piece.owner);
+        addToIndex(str, piece.owner);
+    }
+
+    piece.added = true;
+    piece.start = addBuffer.length();
+    piece.length = str.length();
+    addBuffer.append(str);
+    fullValid = false;
+
+    if (addBuffer.length() > qMax(original.length(), MIN_COMPACT_SIZE))
+        compact();
+    plainValid = piece.doc && plainValid;
+
+    if (delta != 0)
+    {
+        fenwickAdd(lengths, index, delta);
+
+        if (!piece.doc)
+            fenwickAdd(plainLengths, index, delta);
+    }
+
+    return true;
+}
+
+/**
+ * Replace text of docblock piece, text is indented as in rebuild().
+ * @param changed set to true if text of the piece differs from str
+ * @return false if the store is outdated and must be rebuilt anyway
+ */
+bool TextBuffer::replaceDocPiece(int index, const QString &str, bool &changed)
+{
+    if (dirty || index < 0 || index >= pieces.size() || !pieces[index].doc)
+        return false;
+
+    const Piece &piece = pieces[index];
+    QString text = indented(str, piece.indent);
+    changed = text != (piece.added ? addBuffer : original).midRef(piece.start, piece.length);
+
+    return !changed || replacePiece(index, text);
+}
+
+/**
+ * Release piece of given leaf (leaf is being deleted).
+ */
+void TextBuffer::unbind(TreeElement *owner)
+{
+    if (owner->textPiece >= 0 && owner->textPiece < pieces.size()
+            && pieces[owner->textPiece].owner == owner)
+        pieces[owner->textPiece].owner = 0;
+
+    owner->textPiece = -1;
+
+    if (owner != root)
+        owner->textStore = 0;
+
+    dirty = true;
+}
+
+/**
+ * Rebuild the table from the tree. Produces same text as TreeElement::getText(),
+ * but walks the tree iteratively and indents line breaks while emitting them.
+ */
+void TextBuffer::rebuild()
+{
+    TreeElement *keep = root;
+    setRoot(keep);      //! release all pieces, add buffer is dropped too, index is kept
+    dirty = false;
+
+    if (root == 0) return;
+
+    QList<QPair<TreeElement*, int> > stack;    //! open elements + next child index
+    int indent = 0;
+    TreeElement *el = root;
+
+    while (el != 0)
+    {
+        // enter element
+        DocBlock *docBl = 0;
+
+        if (el->isFloating()) docBl = qgraphicsitem_cast<DocBlock*>(el->getBlock());
+
+        el->textDirty = false;
+        appendPiece(QString().fill(' ', el->spaces), false);
+
+        if (el->isLeaf())
+        {
+            if (docBl != 0)
+                appendPiece(indented(docBl->convertToText(), indent), true, el, indent);
+            else if (el->isFloating() || el->type.contains('\n'))
+                appendPiece(indented(el->type, indent), false);
+            else
+                appendPiece(el->type, false, el);   //! plain leaf owns its piece
+
+            if (el->lineBreaking)
+                appendPiece("\n" + QString().fill(' ', indent), docBl != 0);
+        }
+        else
+        {
+            indent += el->spaces;
+
+            if (docBl != 0)
+                appendPiece(indented(docBl->convertToText(), indent), true, el, indent);
+
+            stack.append(qMakePair(el, 0));
+        }
+
+        // find next element to enter, leave finished ones
+        el = 0;
+
+        while (el == 0 && !stack.isEmpty())
+        {
+            QPair<TreeElement*, int> &top = stack.last();
+
+            if (top.second < top.first->children.size())
+            {
+                el = top.first->children.at(top.second++);
+            }
+            else
+            {
+                TreeElement *done = top.first;
+                stack.removeLast();
+                indent -= done->spaces;
+
+                if (done->lineBreaking)
+                {
+                    bool doc = done->isFloating() && qgraphicsitem_cast<DocBlock*>(done->getBlock()) != 0;
+                    appendPiece("\n" + QString().fill(' ', indent), doc);
+                }
+            }
+        }
+    }
+
+    // build fenwick trees in linear time
+    int n = pieces.size();
+    lengths.fill(0, n + 1);
+    plainLengths.fill(0, n + 1);
+
+    for (int i = 1; i <= n; i++)
+    {
+        lengths[i] += pieces[i-1].length;
+        plainLengths[i] += pieces[i-1].doc ? 0 : pieces[i-1].length;
+        int j = i + (i & -i);
+
+        if (j <= n)
+        {
+            lengths[j] += lengths[i];
+            plainLengths[j] += plainLengths[i];
+        }
+    }
+
+    fullText = original;
+    fullValid = true;
+}
+
+/**
+ * Copy text of all pieces to a new original buffer. Add buffer only grows with
+ * token edits, old texts of replaced pieces are dropped here without a tree walk.
+ */
+void TextBuffer::compact()
+{
+    QString text;
+    text.reserve(fenwickSum(lengths, pieces.size()));
+
+    for (int i = 0; i < pieces.size(); i++)
+    {
+        Piece &piece = pieces[i];
+        int start = text.length();
+        text.append((piece.added ? addBuffer : original).midRef(piece.start, piece.length));
+        piece.added = false;
+        piece.start = start;
+    }
+
+    original = text;
+    addBuffer.clear();
+}
+
+void TextBuffer::appendPiece(const QString &str, bool doc, TreeElement *owner, int indent)
+{
+    if (str.isEmpty() && owner == 0) return;
+
+    // merge generated text with previous generated piece
+    if (owner == 0 && !pieces.isEmpty() && pieces.last().owner == 0 && pieces.last().doc == doc)
+    {
+        pieces.last().length += str.length();
+        original.append(str);
+        return;
+    }
+
+    Piece piece;
+    piece.added = false;
+    piece.doc = doc;
+    piece.start = original.length();
+    piece.length = str.length();
+    piece.indent = indent;
+    piece.owner = owner;
+    original.append(str);
+
+    if (owner != 0)
+    {
+        owner->textStore = this;
+        owner->textPiece = pieces.size();
+    }
+
+    pieces.append(piece);
+}
+
+// one search hit with its path of child indexes from root
+typedef QPair<QVector<int>, TreeElement*> OrderedHit;
+
+static bool inDocumentOrder(const OrderedHit &a, const OrderedHit &b)
+{
+    int n = qMin(a.first.size(), b.first.size());
+
+    for (int i = 0; i < n; i++)
+    {
+        if (a.first.at(i) != b.first.at(i))
+            return a.first.at(i) < b.first.at(i);
+    }
+
+    return a.first.size() < b.first.size();     //! ancestor goes before descendant
+}
+
+/**
+ * Returns leafs with given text (or containing it), with inner also nodes of given type.
+ * Only distinct texts are compared, not every element of the tree,
+ * hits are returned in document order.
+ */
+QList<TreeElement*> TextBuffer::find(const QString &str, bool inner, bool exact)
+{
+    QList<TreeElement*> found;
+
+    if (exact)
+    {
+        Index::const_iterator it = typeIndex.constFind(str);
+
+        if (it != typeIndex.constEnd())
+            found = it.value().toList();
+    }
+    else
+    {
+        for (Index::const_iterator it = typeIndex.constBegin(); it != typeIndex.constEnd(); ++it)
+        {
+            if (it.key().contains(str))
+                found += it.value().toList();
+        }
+    }
+
+    // order hits by their paths, costs depth of hits, not size of tree
+    QList<OrderedHit> hits;
+
+    foreach (TreeElement *el, found)
+    {
+        if (!inner && !el->isLeaf()) continue;
+
+        QVector<int> path;
+
+        for (TreeElement *e = el; e->parent != 0; e = e->parent)
+            path.prepend(e->index());
+
+        hits << qMakePair(path, el);
+    }
+
+    qSort(hits.begin(), hits.end(), inDocumentOrder);
+    found.clear();
+
+    foreach (OrderedHit hit, hits)
+        found << hit.second;
+
+    return found;
+}
+
+/**
+ * Add top and its descendants to search index, called when subtree is attached to my tree.
+ */
+void TextBuffer::indexSubtree(TreeElement *top)
+{
+    QList<TreeElement*> stack;
+    stack << top;
+
+    while (!stack.isEmpty())
+    {
+        TreeElement *el = stack.takeLast();
+        el->indexed = true;
+        addToIndex(el->type, el);
+        stack += el->children;
+    }
+}
+
+/**
+ * Remove top and its descendants from search index, called when subtree is detached.
+ */
+void TextBuffer::unindexSubtree(TreeElement *top)
+{
+    QList<TreeElement*> stack;
+    stack << top;
+
+    while (!stack.isEmpty())
+    {
+        TreeElement *el = stack.takeLast();
+        el->indexed = false;
+        removeFromIndex(el->type, el);
+        stack += el->children;
+    }
+}
+
+/**
+ * Move element in search index after its type changed.
+ */
+void TextBuffer::retype(TreeElement *el, const QString &oldType)
+{
+    removeFromIndex(oldType, el);
+    addToIndex(el->type, el);
+}
+
+void TextBuffer::addToIndex(const QString &key, TreeElement *el)
+{
+    typeIndex[key].insert(el);
+}
+
+void TextBuffer::removeFromIndex(const QString &key, TreeElement *el)
+{
+    Index::iterator it = typeIndex.find(key);
+
+    if (it == typeIndex.end()) return;
+
+    it.value().remove(el);
+
+    if (it.value().isEmpty())
+        typeIndex.erase(it);
+}
+
+QString TextBuffer::indented(QString str, int indent) const
+{
+    if (indent > 0)
+        str.replace("\n", "\n" + QString().fill(' ', indent));
+
+    return str;
+}
+
+void TextBuffer::fenwickAdd(QVector<int> &tree, int index, int delta)
+{
+    for (int i = index + 1; i < tree.size(); i += i & -i)
+        tree[i] += delta;
+}
+
+/**
+ * Returns sum of lengths of the first count pieces.
+ */
+int TextBuffer::fenwickSum(const QVector<int> &tree, int count) const
+{
+    int sum = 0;
+
+    for (int i = count; i > 0; i -= i & -i)
+        sum += tree[i];
+
+    return sum;
+}
@@ -0,0 +1,89 @@
+/**
+ * text_buffer.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class TextBuffer and it's funtions and identifiers
+ *
+ */
+
+#ifndef TEXT_BUFFER_H
+#define TEXT_BUFFER_H
+
+#include <QString>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QList>
+
+class TreeElement;
+
+/**
+ * Piece table holding the text of one AST (one BlockGroup).
+ * Every plain leaf of the tree owns one piece, so editing a token only
+ * replaces that piece (O(log n)) instead of walking the whole tree,
+ * pieces are joined again only when the text is read.
+ * Structural changes of the tree just mark the table dirty, it is then
+ * rebuilt lazily on next read.
+ * Together with pieces the store keeps inverted index of leaf texts and node
+ * types used by search. The index is not rebuilt with pieces, it is updated
+ * for every attached, detached or retyped subtree only.
+ */
+class TextBuffer
+{
+public:
+    TextBuffer();
+    ~TextBuffer();
+
+    void setRoot(TreeElement *root);
+    TreeElement *getRoot() const {return root;}
+    void invalidate() {dirty = true;}
+    bool isDirty() const {return dirty;}
+
+    QString text(bool noDocs = false);
+    int length(bool noDocs = false);
+
+    bool replacePiece(int index, const QString &str);
+    bool replaceDocPiece(int index, const QString &str, bool &changed);
+    void unbind(TreeElement *owner);
+
+    QList<TreeElement*> find(const QString &str, bool inner, bool exact);
+    void indexSubtree(TreeElement *top);
+    void unindexSubtree(TreeElement *top);
+    void retype(TreeElement *el, const QString &oldType);
+
+private:
+    struct Piece
+    {
+        bool added;         //! piece lives in add buffer
+        bool doc;           //! piece is text of docblock (skipped for noDocs)
+        int start;
+        int length;
+        int indent;         //! indentation of docblock text
+        TreeElement *owner; //! leaf (or docblock element) owning this piece, 0 for generated text
+    };
+
+    void releasePieces();
+    void rebuild();
+    void compact();
+    void appendPiece(const QString &str, bool doc, TreeElement *owner = 0, int indent = 0);
+    QString indented(QString str, int indent) const;
+
+    typedef QHash<QString, QSet<TreeElement*> > Index;
+    void addToIndex(const QString &key, TreeElement *el);
+    void removeFromIndex(const QString &key, TreeElement *el);
+
+    // fenwick trees over piece lengths (full text and text without docs)
+    void fenwickAdd(QVector<int> &tree, int index, int delta);
+    int fenwickSum(const QVector<int> &tree, int count) const;
+
+    TreeElement *root;
+    bool dirty;
+    QString original;       //! text of tree at last rebuild
+    QString addBuffer;      //! text appended by later edits, dropped by rebuild() and compact()
+    QVector<Piece> pieces;
+    QVector<int> lengths, plainLengths;
+    QString fullText, plainText; //! joined text, valid until next edit
+    bool fullValid, plainValid;
+    Index typeIndex;        //! elements by their type (text of leafs)
+};
+
+#endif // TEXT_BUFFER_H
@@ -14,6 +14,7 @@
 #include "tree_element.h"
 #include "block.h"
 #include "text_item.h"
+#include "plain_text_layout.h"
 #include <QTextItem>
 
 TextGroup::TextGroup(BlockGroup *block, DocumentScene *scene)
@@ -22,6 +23,14 @@ TextGroup::TextGroup(BlockGroup *block, DocumentScene *scene)
     this->block = block;
     this->scene = scene;
 
+    // lines are laid out like in QPlainTextEdit, unwrapped, only visible ones are painted
+    QTextDocument *doc = new QTextDocument(this);
+    doc->setDocumentLayout(new PlainTextLayout(doc));
+    QTextOption option = doc->defaultTextOption();
+    option.setWrapMode(QTextOption::NoWrap);
+    doc->setDefaultTextOption(option);
+    setDocument(doc);
+
 //    this->setPlainText(block->toText());
     this->setPos(block->pos().x(),block->pos().y());
     this->setScale(block->scale());
@@ -14,9 +14,8 @@
 TextItem::TextItem(const QString &text, Block *parentBlock, bool multiText, bool paired)
     : QGraphicsTextItem(text, parentBlock)
 {
-    myBlock = parentBlock;
+    myBlock = 0;
 
-    this->multiText = multiText;
     setFlag(QGraphicsItem::ItemIsSelectable, false);
     setFlag(QGraphicsItem::ItemIsFocusable, false);
     setTextInteractionFlags(Qt::TextEditable | Qt::TextSelectableByKeyboard);
@@ -27,6 +26,30 @@ TextItem::TextItem(const QString &text, Block *parentBlock, bool multiText, bool
     QFontMetricsF *fm = new QFontMetricsF(font());
     MARGIN = (QGraphicsTextItem::boundingRect().width() - fm->width(toPlainText())) / 2;
 
+    setBlock(parentBlock, multiText, paired);
+    setPos(QPointF());
+}
+
+/**
+ * Attach item to given block, connections to previous block are removed.
+ * Items of leafs are recycled by BlockGroup, 0 detaches the item (pooled item).
+ */
+void TextItem::setBlock(Block *parentBlock, bool multiText, bool paired)
+{
+    if (myBlock != 0)
+    {
+        disconnect(this, 0, 0, 0);
+        disconnect(document(), SIGNAL(contentsChanged()), myBlock, SLOT(textChanged()));
+    }
+
+    myBlock = parentBlock;
+    this->multiText = multiText;
+
+    if (myBlock == 0) return;
+
+    if (parentItem() != myBlock)
+        setParentItem(myBlock);
+
     if (paired) //! emit focusChanged() only for paired blocks
         connect(this, SIGNAL(focusChanged(QFocusEvent*)), myBlock, SLOT(textFocusChanged(QFocusEvent*)));
 
@@ -37,8 +60,6 @@ TextItem::TextItem(const QString &text, Block *parentBlock, bool multiText, bool
     connect(this, SIGNAL(erasePressed(Block*, int)), myBlock->blockGroup(), SLOT(eraseChar(Block*, int)));
     connect(this, SIGNAL(moveCursor(Block*, int, int)), myBlock->blockGroup(),
             SLOT(moveFrom(Block*, int, int)));
-
-    setPos(QPointF());
 }
 
 void TextItem::setFont(const QFont &font)
@@ -126,6 +147,14 @@ void TextItem::keyPressEvent(QKeyEvent *event)
         return;
     }
 
+    // block moves are handled by group
+    if (event->modifiers() == (Qt::ControlModifier | Qt::ShiftModifier)
+        && (event->key() == Qt::Key_Up || event->key() == Qt::Key_Down))
+    {
+        event->ignore();
+        return;
+    }
+
     if ((event->modifiers() & Qt::ControlModifier) == Qt::ControlModifier)
         event->ignore();
     else QGraphicsTextItem::keyPressEvent(event);
@@ -209,6 +238,11 @@ void TextItem::focusOutEvent(QFocusEvent *event)
     QGraphicsTextItem::focusOutEvent(event);
 //    myBlock->textFocusChanged(event);
     emit focusChanged(event);
+
+    // give item back to pool once current action finishes, block paints text itself
+    if (myBlock != 0 && event->reason() != Qt::ActiveWindowFocusReason
+            && event->reason() != Qt::PopupFocusReason)
+        QTimer::singleShot(0, myBlock->blockGroup(), SLOT(releaseTextItems()));
 }
 
 void TextItem::adaptToFloating()
@@ -21,6 +21,9 @@ public:
     enum { Type = UserType + 9 };
     int type() const {return Type;}
 
+    void setBlock(Block *parentBlock, bool multiText = false, bool paired = false);
+    Block *block() const {return myBlock;}
+
     bool setTextCursorPos(int i);
     bool removeCharAt(int i);   //! returns false if text is empty after removal
 
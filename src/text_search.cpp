@@ -0,0 +1,295 @@
+/**
+* @file text_search.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class TextSearch and it's functions and identifiers.
+*/
+
+#include "text_search.h"
+#include "block_group.h"
+
+#include <QtConcurrentMap>
+#include <QRegExp>
+#include <QSet>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+const int CHUNK_SIZE = 1 << 20; // characters scanned by one worker
+
+/**
+ * Returns index of first c in data[from, to), -1 if there is none.
+ * Compares 8 characters at once where SSE2 is available.
+ */
+static int findChar(const ushort *data, int from, int to, ushort c)
+{
+    int i = from;
+
+#ifdef __SSE2__
+    const __m128i needle = _mm_set1_epi16(c);
+
+    for (; i + 8 <= to; i += 8)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(block, needle));
+
+        if (mask != 0)
+        {
+            while ((mask & 3) == 0) //! 2 mask bits per character
+            {
+                mask >>= 2;
+                i++;
+            }
+
+            return i;
+        }
+    }
+#endif
+
+    for (; i < to; i++)
+    {
+        if (data[i] == c) return i;
+    }
+
+    return -1;
+}
+
+/**
+ * Returns count of c in data[from, to).
+ */
+static int countChar(const ushort *data, int from, int to, ushort c)
+{
+    int count = 0;
+    int i = from;
+
+#ifdef __SSE2__
+    const __m128i needle = _mm_set1_epi16(c);
+
+    while (i + 8 <= to)
+    {
+        // matches are summed in 16 bit lanes, flushed before they could overflow
+        __m128i sum = _mm_setzero_si128();
+        int end = qMin(to - 7, i + 8 * 0x7fff);
+
+        for (; i < end; i += 8)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            sum = _mm_sub_epi16(sum, _mm_cmpeq_epi16(block, needle));
+        }
+
+        ushort lanes[8];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+
+        for (int k = 0; k < 8; k++)
+            count += lanes[k];
+    }
+#endif
+
+    for (; i < to; i++)
+    {
+        if (data[i] == c) count++;
+    }
+
+    return count;
+}
+
+TextSearch::TextSearch(QObject *parent)
+    : QObject(parent)
+{
+    nextChunk = nextLine = 0;
+    found = false;
+
+    connect(&watcher, SIGNAL(resultReadyAt(int)), this, SLOT(chunkReady(int)));
+    connect(&watcher, SIGNAL(finished()), this, SLOT(allReady()));
+}
+
+TextSearch::~TextSearch()
+{
+    cancel();
+    watcher.waitForFinished();
+}
+
+/**
+ * Search lines of text containing pattern, pattern in /slashes/ is regular expression.
+ * Matches are highlighted in group while the search is running.
+ */
+void TextSearch::start(BlockGroup *searched, const QString &text, QString pattern)
+{
+    cancel();
+
+    group = searched;
+    found = false;
+    nextChunk = nextLine = 0;
+
+    bool regExp = parsePattern(pattern);
+
+    // split text to chunks ending with line break
+    QList<TextChunk> chunks;
+    int from = 0;
+
+    while (from < text.length())
+    {
+        int to = text.indexOf('\n', from + CHUNK_SIZE);
+        to = (to < 0) ? text.length() : to + 1;
+
+        TextChunk chunk;
+        chunk.text = text;
+        chunk.from = from;
+        chunk.to = to;
+        chunk.pattern = pattern;
+        chunk.regExp = regExp;
+        chunks << chunk;
+
+        from = to;
+    }
+
+    ready.fill(false, chunks.size());
+    watcher.setFuture(QtConcurrent::mapped(chunks, &TextSearch::scanChunk));
+}
+
+/**
+ * Returns true if pattern is in /slashes/, slashes are removed.
+ */
+bool TextSearch::parsePattern(QString &pattern)
+{
+    bool regExp = pattern.length() > 2 && pattern.startsWith('/') && pattern.endsWith('/');
+
+    if (regExp) pattern = pattern.mid(1, pattern.length() - 2);
+
+    return regExp;
+}
+
+/**
+ * Lines of text containing pattern, scanned in calling thread as one chunk.
+ */
+QList<int> TextSearch::findLines(const QString &text, QString pattern)
+{
+    TextChunk chunk;
+    chunk.regExp = parsePattern(pattern);
+    chunk.text = text;
+    chunk.from = 0;
+    chunk.to = text.length();
+    chunk.pattern = pattern;
+
+    return scanChunk(chunk).lines;
+}
+
+void TextSearch::cancel()
+{
+    if (watcher.isRunning())
+        watcher.cancel();
+
+    ready.clear();
+}
+
+/**
+ * Scan one chunk, runs on thread pool. Candidates are found by first character
+ * of pattern and verified by comparing the rest, only 1 match per line is needed.
+ */
+ChunkMatches TextSearch::scanChunk(const TextChunk &chunk)
+{
+    ChunkMatches matches;
+    const ushort *data = chunk.text.utf16();
+    int line = 0;
+
+    if (chunk.regExp)
+    {
+        QRegExp regExp(chunk.pattern);
+        int start = chunk.from;
+
+        while (start < chunk.to)
+        {
+            int end = findChar(data, start, chunk.to, '\n');
+
+            if (end < 0) end = chunk.to;
+
+            QString lineText = QString::fromRawData(chunk.text.constData() + start, end - start);
+
+            if (regExp.indexIn(lineText) > -1)
+                matches.lines << line;
+
+            line++;
+            start = end + 1;
+        }
+
+        matches.lineCount = countChar(data, chunk.from, chunk.to, '\n');
+        return matches;
+    }
+
+    const ushort *pattern = chunk.pattern.utf16();
+    int length = chunk.pattern.length();
+    int last = chunk.to - length + 1;   //! last possible start of match + 1
+    int counted = chunk.from;           //! line breaks before this are in line
+    int pos = chunk.from;
+
+    while (pos < last)
+    {
+        pos = findChar(data, pos, last, pattern[0]);
+
+        if (pos < 0) break;
+
+        if (memcmp(data + pos + 1, pattern + 1, (length - 1) * sizeof(ushort)) != 0)
+        {
+            pos++;
+            continue;
+        }
+
+        line += countChar(data, counted, pos, '\n');
+        matches.lines << line;
+
+        // skip rest of matched line
+        int end = findChar(data, pos, chunk.to, '\n');
+
+        if (end < 0)
+        {
+            counted = chunk.to;
+            break;
+        }
+
+        line++;
+        counted = pos = end + 1;
+    }
+
+    matches.lineCount = line + countChar(data, counted, chunk.to, '\n');
+    return matches;
+}
+
+/**
+ * Pass matches of finished chunks to group, in order of chunks.
+ */
+void TextSearch::chunkReady(int index)
+{
+    if (watcher.isCanceled() || index >= ready.size()) return;
+
+    ready[index] = true;
+    QSet<int> lines;
+
+    while (nextChunk < ready.size() && ready.at(nextChunk))
+    {
+        ChunkMatches matches = watcher.resultAt(nextChunk);
+
+        foreach (int line, matches.lines)
+            lines << nextLine + line;
+
+        nextLine += matches.lineCount;
+        nextChunk++;
+    }
+
+    if (!lines.isEmpty() && !group.isNull())
+    {
+        found = true;
+        group->highlightLines(lines);
+        group->update();
+    }
+}
+
+void TextSearch::allReady()
+{
+    if (watcher.isCanceled()) return;
+
+    emit finished(found);
+}
@@ -0,0 +1,77 @@
+/**
+ * text_search.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class TextSearch and it's funtions and identifiers
+ *
+ */
+
+#ifndef TEXT_SEARCH_H
+#define TEXT_SEARCH_H
+
+#include <QObject>
+#include <QString>
+#include <QList>
+#include <QVector>
+#include <QPointer>
+#include <QFutureWatcher>
+
+class BlockGroup;
+
+/**
+ * Part of document text scanned by one worker, starts at line start and ends after line break.
+ */
+struct TextChunk
+{
+    QString text;       //! whole document text, shared by all chunks
+    int from, to;       //! scanned range
+    QString pattern;
+    bool regExp;        //! pattern is regular expression
+};
+
+/**
+ * Lines of one chunk containing the pattern, counted from start of chunk.
+ */
+struct ChunkMatches
+{
+    QList<int> lines;
+    int lineCount;      //! line breaks in chunk
+};
+
+/**
+ * Plain text search running on thread pool. Document text is split to chunks
+ * scanned in parallel, matched lines are passed to the group in text order as
+ * soon as all preceding chunks are done. Starting new search cancels the running one.
+ */
+class TextSearch : public QObject
+{
+    Q_OBJECT
+
+public:
+    TextSearch(QObject *parent = 0);
+    ~TextSearch();
+
+    void start(BlockGroup *group, const QString &text, QString pattern);
+    void cancel();
+    bool isRunning() const {return watcher.isRunning();}
+
+    static ChunkMatches scanChunk(const TextChunk &chunk);
+    static QList<int> findLines(const QString &text, QString pattern);
+    static bool parsePattern(QString &pattern);
+
+signals:
+    void finished(bool found);
+
+private slots:
+    void chunkReady(int index);
+    void allReady();
+
+private:
+    QFutureWatcher<ChunkMatches> watcher;
+    QPointer<BlockGroup> group;     //! searched group, may be closed while searching
+    QVector<bool> ready;            //! finished chunks
+    int nextChunk;                  //! first chunk not passed to group yet
+    int nextLine;                   //! first line of nextChunk
+    bool found;
+};
+
+#endif // TEXT_SEARCH_H
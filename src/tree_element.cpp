@@ -10,11 +10,13 @@
 #include "tree_element.h"
 #include "block.h"
 #include "doc_block.h"
+#include "text_buffer.h"
 
 
 const char *TreeElement::WHITE_EL = "whites";
 const char *TreeElement::UNKNOWN_EL = "unknown";
 const char *TreeElement::NEWLINE_EL = "nl";
+QAtomicInt TreeElement::instances(0);
 const bool TreeElement::DYNAMIC = false;        //! dynamicke spracovanie AST - now work with nodes and deep
 
 TreeElement::TreeElement(QString type, bool selectable,
@@ -30,12 +32,20 @@ TreeElement::TreeElement(QString type, bool selectable,
     myBlock = 0;
     pair = 0;
     floating = false;
+    textStore = 0;
+    textPiece = -1;
+    textDirty = true;
+    indexed = false;
+    indexHint = -1;
 
     analyzer = 0;
+    instances.ref();
 }
 
 TreeElement::~TreeElement()
 {
+    instances.deref();
+
     if(DYNAMIC){
                                             //! todo dopracuj zmazanie pri dynamickom spracovani
     }else{
@@ -45,28 +55,77 @@ TreeElement::~TreeElement()
         pair = 0;
     }
 
+    if (textStore != 0)
+    {
+        if (textStore->getRoot() == this)
+            textStore->setRoot(0);
+        else
+            textStore->unbind(this);
+    }
+
     if (!isLeaf())
         removeAllChildren();
 
     if (getParent() != 0)
     {
-        if (!getParent()->isImportant())
-            delete parent;
-            //delete getParent();             //! todo otestuj mazanie
-        else
-            getParent()->removeChild(this);
+        // unimportant ancestors (with me as only descendant) die with me,
+        // collect them and delete them detached, instead of recursive delete
+        QList<TreeElement*> chain;
+        TreeElement *top = this;
+
+        while (top->getParent() != 0 && !top->getParent()->isImportant())
+        {
+            top = top->getParent();
+            chain << top;
+        }
+
+        if (top->getParent() != 0)
+            top->getParent()->removeChild(top);
+
+        foreach (TreeElement *el, chain)
+            el->removeAllChildren();
+
+        qDeleteAll(chain);                  //! todo otestuj mazanie
     }
     }
 }
 
 void TreeElement::setType(QString type)
 {
+    if (this->type == type) return;
+
+    QString oldType = this->type;
     this->type = type;
+
+    if (pair != 0)          //! changed token is no longer paired, until reanalysis
+    {
+        pair->setPair(0);
+        pair = 0;
+    }
+
+    // plain leaf: replace only my piece of text store
+    if (textPiece >= 0 && !floating && !type.contains('\n')
+            && textStore->replacePiece(textPiece, type))
+    {
+        invalidateSnapshot();
+        return;
+    }
+
+    TextBuffer *store = indexStore();
+
+    if (store != 0)
+        store->retype(this, oldType);
+
+    invalidateText();
 }
 
 void TreeElement::setBlock(Block *block)
 {
+    if (myBlock == block) return;
+
     myBlock = block;
+
+    if (floating) invalidateText();    //! docblock text depends on block
 }
 
 Block *TreeElement::getBlock() const
@@ -92,6 +151,13 @@ void TreeElement::appendChild(TreeElement *child)
 {
     children.append(child);
     child->parent = this;                           //! prerob cez funkciu napriklad setParent(this)
+    child->indexHint = children.size() - 1;
+    invalidateText();
+
+    TextBuffer *store = indexStore();
+
+    if (store != 0)
+        store->indexSubtree(child);
 }
 
 void TreeElement::appendChildren(QList<TreeElement*> children)
@@ -107,6 +173,13 @@ void TreeElement::insertChild(int index, TreeElement *child)
 {
     children.insert(index, child);                 //! prerob aby fungovalo cez funkciu
     child->parent = this;                          //! prerob cez funkciu napriklad setParent(this)
+    child->indexHint = index;
+    invalidateText();
+
+    TextBuffer *store = indexStore();
+
+    if (store != 0)
+        store->indexSubtree(child);
 }
 
 void TreeElement::insertChildren(int index, QList<TreeElement*> children)
@@ -119,33 +192,44 @@ void TreeElement::insertChildren(int index, QList<TreeElement*> children)
 
 bool TreeElement::removeChild(TreeElement *child)
 {
+    int i = indexOfChild(child);
+    TextBuffer *store = indexStore();
+
+    if (store != 0 && child->parent == this)
+        store->unindexSubtree(child);
+
     child->parent = 0;                            //! prerob cez funkciu napriklad setParent(this)
-    return children.removeOne(child);
+    invalidateText();
+
+    if (i < 0) return false;
+
+    children.removeAt(i);
+    return true;
 }
 
 bool TreeElement::removeDescendant(TreeElement *desc) { //! not used?
-    if (removeChild(desc))
-    {
-        return true;
-    }
-    else
-    {
-        foreach (TreeElement *el, getChildren())
-        {
-            if (el->removeDescendant(desc)) return true;
-
-        }
-    }
+    if (desc == 0 || !isAncestorOf(desc))
+        return false;
 
-    return false;
+    return desc->getParent()->removeChild(desc);
 }
 
 bool TreeElement::removeAllChildren()           //! todo otestuj mazanie
 {
-    if (getChildren().isEmpty()) return false;
+    if (children.isEmpty()) return false;
 
-    foreach (TreeElement *child, getChildren())
-        removeChild(child);
+    TextBuffer *store = indexStore();
+
+    if (store != 0)
+    {
+        foreach (TreeElement *child, children)
+            store->unindexSubtree(child);
+    }
+
+    while (!children.isEmpty())
+        children.takeLast()->parent = 0;
+
+    invalidateText();
 
     return true;
 }
@@ -155,11 +239,22 @@ void TreeElement::deleteAllChildren()           //! todo otestuj mazanie
     if(DYNAMIC){
         qDebug() << "deleteAllChildren()";
     }else{
-    qDeleteAll(getChildren());
-    getChildren().clear();
+    // parents are deleted before their children and detach them, so whole
+    // subtree dies without recursion and nothing is deleted while attached
+    QList<TreeElement*> descendants = getDescendants();
+    removeAllChildren();
+    qDeleteAll(descendants);
     }
 }
 
+/**
+ * Returns number of living elements, Benchmark uses it to check for leaks.
+ */
+int TreeElement::instanceCount()
+{
+    return instances;
+}
+
 bool TreeElement::isLeaf() const
 {
     if(DYNAMIC){
@@ -200,7 +295,12 @@ bool TreeElement::hasSiblings() const
 
 void TreeElement::setSpaces(int number)
 {
-    spaces = qMax(0, number);
+    number = qMax(0, number);
+
+    if (spaces == number) return;
+
+    spaces = number;
+    invalidateText();
 }
 void TreeElement::addSpaces(int number)
 {
@@ -210,15 +310,33 @@ int TreeElement::getSpaces() const
 {
     return spaces;
 }
+// state of one element in adjustSpaces()
+struct SpacesFrame
+{
+    TreeElement *element;
+    int offset;
+    int next;               //! next child index
+    bool newLineComming;
+};
+
 void TreeElement::adjustSpaces(int offset)
 {
-    bool newLineComming = true;
-    bool lb = false;
-    offset += spaces;
+    QList<SpacesFrame> stack;
+    SpacesFrame first = {this, offset + spaces, 0, true};
+    stack.append(first);
 
-    foreach (TreeElement *child, getChildren())
+    while (!stack.isEmpty())
     {
-        lb = child->isLineBreaking();
+        SpacesFrame &top = stack.last();
+
+        if (top.next >= top.element->children.size())
+        {
+            stack.removeLast();
+            continue;
+        }
+
+        TreeElement *child = top.element->children.at(top.next++);
+        bool lb = child->isLineBreaking();
 
         while (!child->isImportant())
         {
@@ -229,16 +347,17 @@ void TreeElement::adjustSpaces(int offset)
 
         child->setLineBreaking(lb);
 
-        if (newLineComming)
+        if (top.newLineComming)
         {
-            child->addSpaces(-offset);
-            newLineComming = false;
+            child->addSpaces(-top.offset);
+            top.newLineComming = false;
         }
 
-        child->adjustSpaces(offset);
-
         if (child->isLineBreaking())
-            newLineComming = true;
+            top.newLineComming = true;
+
+        SpacesFrame frame = {child, top.offset + child->spaces, 0, true};
+        stack.append(frame);                //! adjust child before next sibling
     }
 }
 
@@ -247,6 +366,7 @@ bool TreeElement::setLineBreaking(bool flag)
     if (lineBreaking == flag) return false;
 
     lineBreaking = flag;
+    invalidateText();
 
     return true;
 }
@@ -263,7 +383,10 @@ bool TreeElement::isFloating() const
 
 void TreeElement::setFloating(bool floating)
 {
+    if (this->floating == floating) return;
+
     this->floating = floating;
+    invalidateText();
 }
 
 bool TreeElement::isSelectable() const
@@ -273,10 +396,12 @@ bool TreeElement::isSelectable() const
 
 bool TreeElement::allowsParagraphs() const
 {
-    if (getParent() != 0)
-        return paragraphsAllowed || getParent()->allowsParagraphs();
-    else
-        return paragraphsAllowed;
+    for (const TreeElement *el = this; el != 0; el = el->getParent())
+    {
+        if (el->paragraphsAllowed) return true;
+    }
+
+    return false;
 }
 
 bool TreeElement::isPaired() const
@@ -305,33 +430,40 @@ int TreeElement::index() const
     //if(DYNAMIC){ //zisti priamo z AST lua_tonumber(L,-1)-1
     if (getParent() == 0)
         return -1;
-    else
+
+    if (DYNAMIC)
         return getParent()->indexOfChild(this);
+
+    // cached index is valid unless siblings were inserted/removed before me
+    const QList<TreeElement*> &siblings = parent->children;
+
+    if (indexHint < 0 || indexHint >= siblings.size() || siblings.at(indexHint) != this)
+        indexHint = siblings.indexOf(const_cast<TreeElement*>(this));
+
+    return indexHint;
 }
 
 int TreeElement::indexOfChild(const TreeElement *child) const
 {
-    int p = getChildren().indexOf(const_cast<TreeElement*>(child), 0);
-    return p;
+    if (DYNAMIC)
+        return getChildren().indexOf(const_cast<TreeElement*>(child), 0);
+
+    if (child == 0 || child->parent != this)
+        return -1;
+
+    return child->index();
 }
 
 int TreeElement::indexOfBranch(const TreeElement *desc) const
 {
-    int i = indexOfChild(desc);
+    // climb from descendant to my child
+    while (desc != 0 && desc->getParent() != this)
+        desc = desc->getParent();
 
-    if (i > -1)
-    {
-        return i;
-    }
-    else
-    {
-        for (i = 0; i < getChildren().size(); i++)
-        {
-            if (getChildren()[i]->indexOfBranch(desc) > -1) return i;
-        }
-    }
+    if (desc == 0)
+        return -1;
 
-    return -1;
+    return desc->index();
 }
 
 QList<TreeElement*> TreeElement::getChildren() const
@@ -363,11 +495,8 @@ QList<TreeElement*> TreeElement::getDescendants() const
 {
     QList<TreeElement*> list;
 
-    foreach (TreeElement *child, getChildren())
-    {
-        list << child;
-        list << child->getDescendants();
-    }
+    for (TreeElement *el = nextDescendant(this); el != 0; el = el->nextDescendant(this))
+        list << el;
 
     return list;
 }
@@ -376,15 +505,124 @@ QList<TreeElement*> TreeElement::getAllLeafs() const
 {
     QList<TreeElement*> list;
 
-    foreach (TreeElement *child, getChildren())
+    if (isLeaf()) return list;
+
+    for (TreeElement *el = firstLeaf(); el != 0; el = el->nextLeaf(this))
+        list << el;
+
+    return list;
+}
+
+/**
+ * Returns next element in preorder, limited to descendants of scope.
+ * Use: for (el = root->nextDescendant(root); el != 0; el = el->nextDescendant(root))
+ * @param scope root of traversed subtree, 0 for whole tree
+ * @return next element or 0 at the end of traversal
+ */
+TreeElement *TreeElement::nextDescendant(const TreeElement *scope) const
+{
+    if (!children.isEmpty())
+        return children.first();
+
+    const TreeElement *el = this;
+
+    while (el != scope && el->parent != 0)
     {
-        if (child->isLeaf())
-            list << child;
-        else
-            list << child->getDescendants();
+        int i = el->index() + 1;
+
+        if (i < el->parent->children.size())
+            return el->parent->children.at(i);
+
+        el = el->parent;
     }
 
-    return list;
+    return 0;
+}
+
+TreeElement *TreeElement::firstLeaf() const
+{
+    const TreeElement *el = this;
+
+    while (!el->children.isEmpty())
+        el = el->children.first();
+
+    return const_cast<TreeElement*>(el);
+}
+
+/**
+ * Returns next leaf after this one, limited to descendants of scope.
+ */
+TreeElement *TreeElement::nextLeaf(const TreeElement *scope) const
+{
+    const TreeElement *el = this;
+
+    while (el != scope && el->parent != 0)
+    {
+        int i = el->index() + 1;
+
+        if (i < el->parent->children.size())
+            return el->parent->children.at(i)->firstLeaf();
+
+        el = el->parent;
+    }
+
+    return 0;
+}
+
+bool TreeElement::isAncestorOf(const TreeElement *element) const
+{
+    for (element = element->getParent(); element != 0; element = element->getParent())
+    {
+        if (element == this) return true;
+    }
+
+    return false;
+}
+
+/**
+ * Returns true if other subtree has same types in same shape as mine,
+ * e.g. when spliced tree is compared with result of analysis of its text.
+ */
+bool TreeElement::sameTree(const TreeElement *other) const
+{
+    const TreeElement *mine = this, *theirs = other;
+
+    while (mine != 0 && theirs != 0)
+    {
+        if (mine->type != theirs->type || mine->children.size() != theirs->children.size())
+            return false;
+
+        mine = mine->nextDescendant(this);
+        theirs = theirs->nextDescendant(other);
+    }
+
+    return mine == theirs;
+}
+
+/**
+ * Call visitor for each of my descendants (or leafs) in preorder.
+ * @return false if visitor stopped the traversal
+ */
+bool TreeElement::visitDescendants(TreeVisitor *visitor, bool leafsOnly)
+{
+    if (leafsOnly)
+    {
+        if (isLeaf()) return true;
+
+        for (TreeElement *el = firstLeaf(); el != 0; el = el->nextLeaf(this))
+        {
+            if (!visitor->visit(el)) return false;
+        }
+    }
+    else
+    {
+        for (TreeElement *el = nextDescendant(this); el != 0; el = el->nextDescendant(this))
+        {
+            if (!visitor->visit(el)) return false;
+        }
+    }
+
+    return true;
 }
 
 TreeElement *TreeElement::getAncestorWhereFirst() const
@@ -393,11 +631,11 @@ TreeElement *TreeElement::getAncestorWhereFirst() const
 
     if (el->isFloating()) return el;
 
-    while (el->getParent() != 0 && el->getParent()->indexOfChild(el) == 0)
+    while (el->getParent() != 0 && el->index() == 0)
         el = el->getParent();
 
     while (!el->isImportant())
-        el = el->getChildren()[0];
+        el = el->child(0);
 
     return el;
 }
@@ -408,11 +646,11 @@ TreeElement *TreeElement::getAncestorWhereLast() const
 
     if (el->isFloating()) return el;
 
-    while (el->getParent() != 0 && el->getParent()->indexOfChild(el) == el->getParent()->childCount()-1)
+    while (el->getParent() != 0 && el->index() == el->getParent()->childCount()-1)
         el = el->getParent();
 
     while (!el->isImportant())
-        el = el->getChildren()[el->childCount()-1];
+        el = el->child(el->childCount()-1);
 
     return el;
 }
@@ -420,10 +658,12 @@ TreeElement *TreeElement::getAncestorWhereLast() const
 
 TreeElement *TreeElement::getRoot()
 {
-    if (getParent() == 0)
-        return this;
-    else
-        return getParent()->getRoot();
+    TreeElement *el = this;
+
+    while (el->getParent() != 0)
+        el = el->getParent();
+
+    return el;
 }
 
 TreeElement *TreeElement::getParent() const
@@ -451,59 +691,160 @@ QString TreeElement::getType() const
 }
 
 // returns all text in this element and it's descendants
+// tree is walked with explicit stack, line breaks are indented by spaces of all open ancestors
 QString TreeElement::getText(bool noComments) const
 {
     QString text;
-    DocBlock *docBl = 0;
+    QList<QPair<const TreeElement*, int> > stack;  //! open elements + next child index
+    const TreeElement *el = this;
+    int indent = 0;
 
-    if (isFloating()) docBl = qgraphicsitem_cast<DocBlock*>(myBlock);
+    while (el != 0)
+    {
+        DocBlock *docBl = 0;
 
-    QString spacesStr = QString().fill(' ', spaces);
+        if (el->isFloating()) docBl = qgraphicsitem_cast<DocBlock*>(el->myBlock);
 
-    if (isLeaf())
-    {
-        text = type;                            //! get my text
-        if (docBl != 0)
+        text.append(QString().fill(' ', el->spaces));    //! indent my text
+
+        if (el->isLeaf())
+        {
+            QString str = el->type;                 //! get my text
+
+            if (docBl != 0)
+                str = noComments ? QString() : docBl->convertToText();  //! get text of docblock
+
+            text.append(str.replace("\n", "\n" + QString().fill(' ', indent)));
+
+            if (el->lineBreaking && (docBl == 0 || !noComments))
+                text.append("\n" + QString().fill(' ', indent)); //! add line break if needed
+        }
+        else
         {
-            if (noComments)
-                text = "";
+            indent += el->spaces;
+
+            if (docBl != 0 && !noComments)          //! get text of docblock
+                text.append(docBl->convertToText().replace("\n", "\n" + QString().fill(' ', indent)));
+
+            stack.append(qMakePair(el, 0));
+        }
+
+        el = 0;
+
+        while (el == 0 && !stack.isEmpty())
+        {
+            QPair<const TreeElement*, int> &top = stack.last();
+
+            if (top.second < top.first->children.size())
+            {
+                el = top.first->children.at(top.second++);     //! get child texts
+            }
             else
-                text = docBl->convertToText();      //! get text of docblock
+            {
+                const TreeElement *done = top.first;
+                stack.removeLast();
+                indent -= done->spaces;
+                docBl = 0;
+
+                if (done->isFloating()) docBl = qgraphicsitem_cast<DocBlock*>(done->myBlock);
+
+                if (done->lineBreaking && (docBl == 0 || !noComments))
+                    text.append("\n" + QString().fill(' ', indent));
+            }
         }
     }
-    else
+
+    return text;
+}
+
+/**
+ * Mark my text and text of my ancestors as changed, text store of the tree
+ * is rebuilt on next read. Walk stops at first already changed ancestor.
+ */
+void TreeElement::invalidateText()
+{
+    invalidateSnapshot();
+
+    TreeElement *el = this;
+
+    while (!el->textDirty)
     {
-        if (docBl != 0 && !noComments)
-            text.append(docBl->convertToText());    //! get text of docblock
+        el->textDirty = true;
 
-        foreach (TreeElement *e, getChildren())
+        if (el->parent == 0)
         {
-            text.append(e->getText(noComments));          //! get child texts
+            if (el->textStore != 0) el->textStore->invalidate();
+            return;
         }
 
-        text.replace("\n", "\n"+spacesStr);     //! indent after each line break
+        el = el->parent;
     }
+}
+
+/**
+ * Returns text store indexing my tree, 0 if I am not in an indexed tree.
+ * Only indexed elements walk up to the root, building new trees costs nothing.
+ */
+TextBuffer *TreeElement::indexStore()
+{
+    if (!indexed) return 0;
 
-    text.prepend(spacesStr);                    //! indent my text
+    TreeElement *top = getRoot();
 
-    if (lineBreaking)
+    if (top->textStore != 0 && top->textStore->getRoot() == top)
+        return top->textStore;
+
+    return 0;
+}
+
+/**
+ * Text of my docblock changed, replace only its piece of text store.
+ * Unchanged text keeps both text store and snapshot.
+ */
+void TreeElement::docTextChanged(const QString &text)
+{
+    bool changed = false;
+
+    if (textPiece >= 0 && textStore->replaceDocPiece(textPiece, text, changed))
     {
-        if (docBl == 0 || !noComments)
-            text.append("\n");                      //! add line break if needed
+        if (changed) invalidateSnapshot();
+
+        return;
+    }
+
+    invalidateText();
+}
+
+/**
+ * Drop snapshot nodes of me and my ancestors, next snapshot copies only this spine.
+ * Walk stops at first ancestor without node (its ancestors have none either).
+ */
+void TreeElement::invalidateSnapshot()
+{
+    TreeElement *el = this;
+
+    while (el != 0 && !el->snapshot.isNull())
+    {
+        el->snapshot.clear();
+        el = el->parent;
     }
-//qDebug() << text;
-    return text;
 }
 
 // iterator methods
 bool TreeElement::hasNext()
 {
-    return hasNext(0);
+    if (DYNAMIC)
+        return hasNext(0);
+
+    return nextDescendant() != 0;
 }
 
 TreeElement *TreeElement::next()
 {
-    return next(0);
+    if (DYNAMIC)
+        return next(0);
+
+    return nextDescendant();
 }
 
 bool TreeElement::hasNext(int index)
@@ -564,14 +905,60 @@ TreeElement *TreeElement::operator<<(QList<TreeElement *> children)
 }
 TreeElement *TreeElement::operator[](int index)
 {
-    return getChildren()[index];
+    if (DYNAMIC)
+        return getChildren()[index];
+
+    return children.at(index);
 }
 int TreeElement::operator[](TreeElement* child)
 {
     return indexOfChild(child);
 }
 
+/**
+ * Returns deep copy of my subtree, pairs inside the subtree are copied too.
+ */
 TreeElement *TreeElement::clone() const
+{
+    QHash<const TreeElement*, TreeElement*> pairedClones; //! paired originals -> their clones
+    TreeElement *root = cloneSingle();
+    QList<QPair<const TreeElement*, TreeElement*> > stack;
+    stack.append(qMakePair(this, root));
+
+    while (!stack.isEmpty())
+    {
+        QPair<const TreeElement*, TreeElement*> top = stack.takeLast();
+
+        if (top.first->pair != 0 && top.first != this)
+            pairedClones[top.first] = top.second;
+
+        // append cloned children (this sets their parent field)
+        foreach (TreeElement *child, top.first->children)
+        {
+            TreeElement *childClone = child->cloneSingle();
+            top.second->appendChild(childClone);
+            stack.append(qMakePair(const_cast<const TreeElement*>(child), childClone));
+        }
+    }
+
+    // resolve pairing
+    QHash<const TreeElement*, TreeElement*>::const_iterator it;
+
+    for (it = pairedClones.constBegin(); it != pairedClones.constEnd(); ++it)
+    {
+        TreeElement *pairClone = pairedClones.value(it.key()->pair, 0);
+
+        if (pairClone != 0)
+            it.value()->setPair(pairClone);
+    }
+
+    return root;
+}
+
+/**
+ * Returns copy of me without children.
+ */
+TreeElement *TreeElement::cloneSingle() const
 {
     TreeElement *el = new TreeElement(type, selectable, paragraphsAllowed,
                                      lineBreaking, paired);
@@ -591,39 +978,5 @@ TreeElement *TreeElement::clone() const
         el->appendChild(new TreeElement(docBl->convertToText()));
     }
 
-    // append cloned children (this sets their parent field)
-    foreach (TreeElement *child, children)
-    {
-        el->appendChild(child->clone());
-    }
-
-    // resolve pairing:
-    for (int i = 0; i < getChildren().size(); i++) //! iterate through original children
-    {
-        TreeElement *child;
-        TreeElement *origPair = getChildren()[i]->pair;
-
-        if (origPair == 0)                   //! if original has no pair continue
-            continue;
-
-        if (el->getChildren()[i]->getPair() != 0) //! if clone has pair already set continue
-            continue;
-
-        int j = i;
-        // otherwise find pair-of-original's index j
-        do
-        {
-            child = getChildren()[j];
-            j++;
-        }
-        while (child != origPair && j < getChildren().size());      //refacktoruj na chlidCount?!?
-
-        if (child != origPair || j >= getChildren().size())
-            continue;
-
-        el->getChildren()[i]->setPair(el->getChildren()[j]); //! set pair of clone to clone at index j
-        el->getChildren()[j]->setPair(el->getChildren()[i]); //! and vice versa
-    }
-
     return el;
 }
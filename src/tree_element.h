@@ -9,9 +9,24 @@
 
 #include <QList>
 #include <QString>
+#include <QSharedPointer>
+#include <QAtomicInt>
 #include "analyzer.h"
 
 class Block;
+class TextBuffer;
+class SnapshotNode;
+class TreeElement;
+
+/**
+ * Visitor for TreeElement::visitDescendants(), return false from visit() to stop.
+ */
+class TreeVisitor
+{
+public:
+    virtual ~TreeVisitor() {}
+    virtual bool visit(TreeElement *element) = 0;
+};
 
 class TreeElement
 {
@@ -67,10 +82,23 @@ public:
      QList<TreeElement*> getAncestors() const;
      QList<TreeElement*> getDescendants() const;
      QList<TreeElement*> getAllLeafs() const;
+
+     // traversal without allocation
+     const QList<TreeElement*> &childList() const {return children;}
+     TreeElement *child(int index) const {return children.at(index);}
+     TreeElement *nextDescendant(const TreeElement *scope = 0) const;
+     TreeElement *firstLeaf() const;
+     TreeElement *nextLeaf(const TreeElement *scope = 0) const;
+     bool isAncestorOf(const TreeElement *element) const;
+     bool sameTree(const TreeElement *other) const;
+     bool visitDescendants(TreeVisitor *visitor, bool leafsOnly = false);
      TreeElement *getRoot();
      TreeElement *getParent() const;
      QString getType() const;
      QString getText(bool noComments = false) const;
+     void invalidateText();
+     void docTextChanged(const QString &text);
+     void invalidateSnapshot();
      TreeElement *getAncestorWhereLast() const;
      TreeElement *getAncestorWhereFirst() const;
 
@@ -85,6 +113,8 @@ public:
 
      TreeElement *clone() const;
 
+     static int instanceCount();
+
      Analyzer* analyzer;
      static const char *WHITE_EL;
      static const char *UNKNOWN_EL;
@@ -105,8 +135,22 @@ public:
      bool paired;
      bool floating;
 
+     TextBuffer *textStore;   //! store holding my text (set for root and plain leafs)
+     int textPiece;           //! index of my piece in textStore, -1 if none
+     bool textDirty;          //! my text changed since last rebuild of textStore
+     bool indexed;            //! I am (or was) in search index of a text store
+     QSharedPointer<const SnapshotNode> snapshot; //! immutable copy of me, 0 if changed
+     mutable int indexHint;   //! my last known index in parent
+
+     static QAtomicInt instances;   //! number of living elements
+
+     TreeElement *cloneSingle() const;
+     TextBuffer *indexStore();
      bool hasNext(int index);
      TreeElement *next(int index);
+
+     friend class TextBuffer;
+     friend class TreeSnapshot;
 };
 
 #endif // TREEELEMENT_H
@@ -0,0 +1,174 @@
+/**
+* @file tree_snapshot.cpp
+* @author Team 04 Ufopak + Team 10 Innovators
+* @version
+*
+* @section DESCRIPTION
+* Contains the defintion of class TreeSnapshot and it's functions and identifiers.
+*/
+
+#include "tree_snapshot.h"
+#include "tree_element.h"
+#include "doc_block.h"
+
+#include <QThreadStorage>
+
+TreeSnapshot::TreeSnapshot()
+{
+}
+
+/**
+ * Take snapshot of the tree. Must be called from GUI thread,
+ * resulting snapshot may be passed to any thread.
+ */
+TreeSnapshot::TreeSnapshot(TreeElement *root)
+{
+    if (root != 0)
+        this->root = build(root);
+}
+
+/**
+ * Returns snapshot node of given element, missing nodes are created
+ * bottom-up (only changed spine after an edit), rest is shared.
+ */
+SnapshotNodePtr TreeSnapshot::build(TreeElement *element)
+{
+    if (!element->snapshot.isNull())
+        return element->snapshot;
+
+    QList<QPair<TreeElement*, int> > stack;    //! elements without node + next child index
+    stack.append(qMakePair(element, 0));
+
+    while (!stack.isEmpty())
+    {
+        QPair<TreeElement*, int> &top = stack.last();
+
+        if (top.second < top.first->children.size())
+        {
+            TreeElement *child = top.first->children.at(top.second++);
+
+            if (child->snapshot.isNull())
+                stack.append(qMakePair(child, 0));
+        }
+        else
+        {
+            TreeElement *done = top.first;
+            stack.removeLast();
+            done->snapshot = createNode(done);
+        }
+    }
+
+    return element->snapshot;
+}
+
+SnapshotNodePtr TreeSnapshot::createNode(TreeElement *element)
+{
+    SnapshotNode *node = new SnapshotNode();
+    node->type = element->type;
+    node->spaces = element->spaces;
+    node->lineBreaking = element->lineBreaking;
+    node->floating = element->floating;
+    node->hasDoc = false;
+
+    if (element->floating)
+    {
+        DocBlock *docBl = qgraphicsitem_cast<DocBlock*>(element->getBlock());
+
+        if (docBl != 0)
+        {
+            node->hasDoc = true;
+            node->docText = docBl->convertToText();
+        }
+    }
+
+    node->children.reserve(element->children.size());
+
+    foreach (TreeElement *child, element->children)
+        node->children.append(child->snapshot);
+
+    return SnapshotNodePtr(node, &SnapshotNode::release);
+}
+
+/**
+ * Deleter of snapshot nodes. Deleting a node releases its children, children whose
+ * last reference is dropped are queued and deleted here in a loop, not recursively,
+ * so dropping a deep snapshot can't overflow the stack. Nodes may die on any thread.
+ */
+void SnapshotNode::release(const SnapshotNode *node)
+{
+    static QThreadStorage<QList<const SnapshotNode*>*> queues;
+
+    if (!queues.hasLocalData())
+        queues.setLocalData(new QList<const SnapshotNode*>());
+
+    QList<const SnapshotNode*> *queue = queues.localData();
+    queue->append(node);
+
+    if (queue->size() > 1) return;  //! called while deleting a parent, loop below deletes it
+
+    while (!queue->isEmpty())
+    {
+        delete queue->first();      //! may queue children
+        queue->removeFirst();
+    }
+}
+
+/**
+ * Returns text of the snapshot, same as TreeElement::getText() at snapshot time.
+ */
+QString TreeSnapshot::getText(bool noDocs) const
+{
+    QString text;
+
+    if (root.isNull()) return text;
+
+    QList<QPair<const SnapshotNode*, int> > stack;
+    const SnapshotNode *node = root.data();
+    int indent = 0;
+
+    while (node != 0)
+    {
+        text.append(QString().fill(' ', node->spaces));
+
+        if (node->isLeaf())
+        {
+            QString str = node->hasDoc ? (noDocs ? QString() : node->docText) : node->type;
+            text.append(str.replace("\n", "\n" + QString().fill(' ', indent)));
+
+            if (node->lineBreaking && !(node->hasDoc && noDocs))
+                text.append("\n" + QString().fill(' ', indent));
+        }
+        else
+        {
+            indent += node->spaces;
+
+            if (node->hasDoc && !noDocs)
+                text.append(QString(node->docText).replace("\n", "\n" + QString().fill(' ', indent)));
+
+            stack.append(qMakePair(node, 0));
+        }
+
+        node = 0;
+
+        while (node == 0 && !stack.isEmpty())
+        {
+            QPair<const SnapshotNode*, int> &top = stack.last();
+
+            if (top.second < top.first->children.size())
+            {
+                node = top.first->children.at(top.second++).data();
+            }
+            else
+            {
+                const SnapshotNode *done = top.first;
+                stack.removeLast();
+                indent -= done->spaces;
+
+                if (done->lineBreaking && !(done->hasDoc && noDocs))
+                    text.append("\n" + QString().fill(' ', indent));
+            }
+        }
+    }
+
+    return text;
+}
@@ -0,0 +1,61 @@
+/**
+ * tree_snapshot.h
+ *  ---------------------------------------------------------------------------
+ * Contains the declaration of class TreeSnapshot and it's funtions and identifiers
+ *
+ */
+
+#ifndef TREE_SNAPSHOT_H
+#define TREE_SNAPSHOT_H
+
+#include <QString>
+#include <QVector>
+#include <QSharedPointer>
+
+class TreeElement;
+class SnapshotNode;
+
+typedef QSharedPointer<const SnapshotNode> SnapshotNodePtr;
+
+/**
+ * Immutable copy of one TreeElement. Nodes are shared between snapshots,
+ * editing the tree copies only the changed element and its ancestors.
+ */
+class SnapshotNode
+{
+public:
+    QString type;
+    int spaces;
+    bool lineBreaking;
+    bool floating;
+    bool hasDoc;            //! element belongs to docblock
+    QString docText;        //! text of docblock (if any)
+    QVector<SnapshotNodePtr> children;
+
+    bool isLeaf() const {return children.isEmpty();}
+
+    static void release(const SnapshotNode *node);
+};
+
+/**
+ * Consistent read-only version of an AST. Taking a snapshot of an unchanged
+ * tree is O(1), snapshots can be copied and read from any thread.
+ */
+class TreeSnapshot
+{
+public:
+    TreeSnapshot();
+    explicit TreeSnapshot(TreeElement *root);
+
+    bool isNull() const {return root.isNull();}
+    SnapshotNodePtr getRoot() const {return root;}
+    QString getText(bool noDocs = false) const;
+
+private:
+    static SnapshotNodePtr build(TreeElement *element);
+    static SnapshotNodePtr createNode(TreeElement *element);
+
+    SnapshotNodePtr root;
+};
+
+#endif // TREE_SNAPSHOT_H